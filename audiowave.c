@@ -120,7 +120,7 @@ void AudioWave_Wave(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, in
     int count, maxdrawcount;
     TextScreenBitmap *bitmap;
     
-    bitmap = TextScreen_CreateBitmap(wavebitmap->width, wavebitmap->height);
+    bitmap = TextScreen_AcquireBitmap(wavebitmap->width, wavebitmap->height);
     if (!bitmap) return;
     
     lpos = bitmap->height * 1 / 4;   // Left  draw offset
@@ -146,7 +146,7 @@ void AudioWave_Wave(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, in
     TextScreen_PutCell(bitmap, 0, rpos, 'R');
     
     TextScreen_CopyBitmap(wavebitmap, bitmap, 0, 0);
-    TextScreen_FreeBitmap(bitmap);
+    TextScreen_ReleaseBitmap(bitmap);
 }
 
 void AudioWave_Circle(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, int stream16len)
@@ -159,7 +159,7 @@ void AudioWave_Circle(TextScreenBitmap *wavebitmap, const int16_t *stream16buf,
     int lr, rr;
     TextScreenBitmap *bitmap;
     
-    bitmap = TextScreen_CreateBitmap(wavebitmap->width, wavebitmap->height);
+    bitmap = TextScreen_AcquireBitmap(wavebitmap->width, wavebitmap->height);
     if (!bitmap) return;
     
     lpos = bitmap->width * 1 / 4;   // Left  draw x offset
@@ -191,7 +191,7 @@ void AudioWave_Circle(TextScreenBitmap *wavebitmap, const int16_t *stream16buf,
     TextScreen_PutCell(bitmap, rpos, ypos, 'R');
     
     TextScreen_CopyBitmap(wavebitmap, bitmap, 0, 0);
-    TextScreen_FreeBitmap(bitmap);
+    TextScreen_ReleaseBitmap(bitmap);
 }
 
 void AudioWave_ScrollPeak(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, int stream16len)
@@ -205,7 +205,7 @@ void AudioWave_ScrollPeak(TextScreenBitmap *wavebitmap, const int16_t *stream16b
     int interval = 5;
     TextScreenBitmap *bitmap;
     
-    bitmap = TextScreen_CreateBitmap(wavebitmap->width, wavebitmap->height);
+    bitmap = TextScreen_AcquireBitmap(wavebitmap->width, wavebitmap->height);
     if (!bitmap) return;
     
     if (packetcount % interval == 0) {
@@ -257,7 +257,7 @@ void AudioWave_ScrollPeak(TextScreenBitmap *wavebitmap, const int16_t *stream16b
     packetcount++;
     
     TextScreen_CopyBitmap(wavebitmap, bitmap, 0, 0);
-    TextScreen_FreeBitmap(bitmap);
+    TextScreen_ReleaseBitmap(bitmap);
 }
 
 void AudioWave_ScrollRms(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, int stream16len)
@@ -272,7 +272,7 @@ void AudioWave_ScrollRms(TextScreenBitmap *wavebitmap, const int16_t *stream16bu
     int interval = 5;
     TextScreenBitmap *bitmap;
     
-    bitmap = TextScreen_CreateBitmap(wavebitmap->width, wavebitmap->height);
+    bitmap = TextScreen_AcquireBitmap(wavebitmap->width, wavebitmap->height);
     if (!bitmap) return;
     
     if (packetcount % interval == 0) {
@@ -336,7 +336,7 @@ void AudioWave_ScrollRms(TextScreenBitmap *wavebitmap, const int16_t *stream16bu
     packetcount++;
     
     TextScreen_CopyBitmap(wavebitmap, bitmap, 0, 0);
-    TextScreen_FreeBitmap(bitmap);
+    TextScreen_ReleaseBitmap(bitmap);
 }
 
 void AudioWave_Spectrum(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, int stream16len)
@@ -352,7 +352,7 @@ void AudioWave_Spectrum(TextScreenBitmap *wavebitmap, const int16_t *stream16buf
     int64_t   countmaxa[38], countmax;
     TextScreenBitmap *bitmap;
     
-    bitmap = TextScreen_CreateBitmap(wavebitmap->width, wavebitmap->height);
+    bitmap = TextScreen_AcquireBitmap(wavebitmap->width, wavebitmap->height);
     if (!bitmap) return;
     
     
@@ -460,7 +460,7 @@ void AudioWave_Spectrum(TextScreenBitmap *wavebitmap, const int16_t *stream16buf
     TextScreen_DrawText(bitmap, rpos, bitmap->height - 1, "R [sqrt/log 63Hz-1kHz-16kHz]");
     
     TextScreen_CopyBitmap(wavebitmap, bitmap, 0, 0);
-    TextScreen_FreeBitmap(bitmap);
+    TextScreen_ReleaseBitmap(bitmap);
 }
 
 void AudioWave_SpectrumTone(TextScreenBitmap *wavebitmap, const int16_t *stream16buf, int stream16len)
@@ -479,7 +479,7 @@ void AudioWave_SpectrumTone(TextScreenBitmap *wavebitmap, const int16_t *stream1
     int64_t   countmaxa[128], countmax;
     TextScreenBitmap *bitmap;
     
-    bitmap = TextScreen_CreateBitmap(wavebitmap->width, wavebitmap->height);
+    bitmap = TextScreen_AcquireBitmap(wavebitmap->width, wavebitmap->height);
     if (!bitmap) return;
     
     
@@ -598,6 +598,6 @@ void AudioWave_SpectrumTone(TextScreenBitmap *wavebitmap, const int16_t *stream1
     }
     
     TextScreen_CopyBitmap(wavebitmap, bitmap, 0, 0);
-    TextScreen_FreeBitmap(bitmap);
+    TextScreen_ReleaseBitmap(bitmap);
 }
 
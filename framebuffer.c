@@ -16,8 +16,17 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef _WIN32
+// for use gettimeofday()
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
 #include <pthread.h>
 
 #ifdef _WIN32
@@ -27,7 +36,7 @@
 #include "framebuffer.h"
 
 #define FRAMEBUFFER_USE_W32THREADS  0
-#define FRAMEBUFFER_PROC_TYPE       4
+#define FRAMEBUFFER_PROC_TYPE       5
 
 // AV_NOPTS_VALUE same as libavutil/avutil.h
 #ifndef AV_NOPTS_VALUE
@@ -40,400 +49,973 @@ typedef HANDLE            mutexobj_t;
 #define MUTEX_DESTROY(x)  CloseHandle((x))
 #define MUTEX_LOCK(x)     WaitForSingleObject((x),INFINITE)
 #define MUTEX_UNLOCK(x)   ReleaseMutex((x))
+#define MUTEX_TRYLOCK(x)  (WaitForSingleObject((x),0) == WAIT_OBJECT_0)
 #else
 typedef pthread_mutex_t   mutexobj_t;
 #define MUTEX_CREATE(x)   (!pthread_mutex_init(&(x),NULL))
 #define MUTEX_DESTROY(x)  pthread_mutex_destroy(&(x))
 #define MUTEX_LOCK(x)     pthread_mutex_lock(&(x))
 #define MUTEX_UNLOCK(x)   pthread_mutex_unlock(&(x))
+#define MUTEX_TRYLOCK(x)  (!pthread_mutex_trylock(&(x)))
 #endif
 
+// queue index access (gcc __atomic builtins. gcc 4.7 or later)
+#define ATOMIC_LOAD(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(x, v)    __atomic_add_fetch(&(x), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_FENCE()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+
+#if FRAMEBUFFER_PROC_TYPE == 5
+// type 5 ===================================================
+// one bounded single-producer/single-consumer ring per FRAMEBUFFER_TYPE_*.
+// Put, Get, GetNoRemove and ListNum are O(1) and never block.
+// for each type, Put must be called from only one thread (producer) and
+// Get/GetNoRemove/Sendback from only one other thread (consumer) at the same time.
+// (Sendback moves head back. it returns a node just got by consumer)
+// ListNum and isFramebuffer_Full can be called from any thread.
+// GetPts is consumer side (it skips flushed nodes like GetNoRemove).
+// WaitGet (consumer) and WaitSpace (producer) sleep on a per-queue condition variable.
+// the mutex is touched by Put/Get only when someone is waiting.
+
+// flush: Framebuffer_Flush (producer) only moves 'flushpos' to tail. nodes before flushpos are
+// not counted any more, and consumer skips them (moves head) at next Get/GetNoRemove/Sendback
+// (or Discard) without freeing. producer frees skipped nodes at next Put (or Reclaim).
+// stale nodes stay in ring until then, so limit of number is max half of ring.
+
+// return: consumer which must not free memory (real-time audio thread) gives used nodes back
+// with Framebuffer_Return. they are freed by producer at next Put (or Reclaim) too.
+
+// queue limit: isFramebuffer_Full() is true when number of nodes, total duration (pts time)
+// or total bytes reaches limit (see Framebuffer_SetLimit). Put fails only when ring is full.
+
+// FRAMEBUFFER_RINGSIZE must be power of 2, and greater than FRAMEBUFFER_MAXBUFFER_* + 1
+#define FRAMEBUFFER_RINGSIZE   512
+#define FRAMEBUFFER_RINGLIMIT  (FRAMEBUFFER_RINGSIZE - 2)
+#define FRAMEBUFFER_MAXLIMIT   (FRAMEBUFFER_RINGSIZE / 2 - 1)
+#define FRAMEBUFFER_RINGMASK   (FRAMEBUFFER_RINGSIZE - 1)
+#define FRAMEBUFFER_CACHELINE  64
+
+typedef struct FramebufferPool {
+    Framebuffer  *freelist;
+    int          count;     // number of nodes in freelist
+    int          maxcount;
+    int          slabsize;  // payload size of pooled node
+    mutexobj_t   mutex;
+} FramebufferPool;
+
+typedef struct FramebufferQueue {
+    Framebuffer  *ring[FRAMEBUFFER_RINGSIZE];
+    Framebuffer  *retring[FRAMEBUFFER_RINGSIZE];  // nodes returned by consumer
+    int          maxsize;      // limit: number of nodes
+    int64_t      maxduration;  // limit: total duration (usec)  0: no limit
+    int64_t      maxbytes;     // limit: total bytes            0: no limit
+    char         pad0[FRAMEBUFFER_CACHELINE];
+    unsigned int head;         // read position  (written by consumer only)
+    int64_t      getduration;  // cumulative duration of got nodes (written by consumer only)
+    int64_t      getbytes;     // cumulative bytes of got nodes    (written by consumer only)
+    unsigned int rettail;      // write position of retring (written by consumer only)
+    char         pad1[FRAMEBUFFER_CACHELINE];
+    unsigned int tail;         // write position (written by producer only)
+    int64_t      putduration;  // cumulative duration of put nodes (written by producer only)
+    int64_t      putbytes;     // cumulative bytes of put nodes    (written by producer only)
+    unsigned int flushpos;       // nodes before this position are flushed (written by producer only)
+    int64_t      flushduration;  // putduration at flush
+    int64_t      flushbytes;     // putbytes at flush
+    unsigned int reclaimpos;     // skipped nodes before this position are freed (written by producer only)
+    unsigned int rethead;        // read position of retring (written by producer only)
+    char         pad2[FRAMEBUFFER_CACHELINE];
+    int          waiters;  // number of threads in Framebuffer_Wait*()
+    mutexobj_t   mutex;
+    pthread_cond_t cond;
+    FramebufferPool pool;
+    FramebufferStats stats;  // highwater/puts/rejects: producer, lowwater/histogram/gets: consumer
+} FramebufferQueue;
+
+static int64_t framebuffermemory;  // bytes in use (nodes, slabs and reported memory)
+static int64_t framebufferbudget;  // 0: no limit
+
+static FramebufferQueue framebufferqueuevideo;
+static FramebufferQueue framebufferqueueaudio;
+static FramebufferQueue framebufferqueuevoid;
+static FramebufferQueue framebufferqueueaudiowave;
+static FramebufferQueue framebufferqueuepresent;
+static FramebufferQueue framebufferqueueapacket;
+static FramebufferQueue framebufferqueuevpacket;
+
+static FramebufferQueue *Framebuffer_GetQueue(int type)
+{
+    FramebufferQueue *queue;
+    
+    switch (type) {
+        case FRAMEBUFFER_TYPE_AUDIO:
+            queue = &framebufferqueueaudio;
+            break;
+        case FRAMEBUFFER_TYPE_VIDEO:
+            queue = &framebufferqueuevideo;
+            break;
+        case FRAMEBUFFER_TYPE_AUDIOWAVE:
+            queue = &framebufferqueueaudiowave;
+            break;
+        case FRAMEBUFFER_TYPE_PRESENT:
+            queue = &framebufferqueuepresent;
+            break;
+        case FRAMEBUFFER_TYPE_APACKET:
+            queue = &framebufferqueueapacket;
+            break;
+        case FRAMEBUFFER_TYPE_VPACKET:
+            queue = &framebufferqueuevpacket;
+            break;
+        case FRAMEBUFFER_TYPE_VOID:
+        default:
+            queue = &framebufferqueuevoid;
+            break;
+    }
+    
+    return queue;
+}
+
+static int Framebuffer_InitQueue(FramebufferQueue *queue, int maxsize)
+{
+    int i;
+    
+    if (!MUTEX_CREATE(queue->mutex)) return -1;
+    if (pthread_cond_init(&queue->cond, NULL)) {
+        MUTEX_DESTROY(queue->mutex);
+        return -1;
+    }
+    if (!MUTEX_CREATE(queue->pool.mutex)) {
+        pthread_cond_destroy(&queue->cond);
+        MUTEX_DESTROY(queue->mutex);
+        return -1;
+    }
+    queue->pool.freelist = NULL;
+    queue->pool.count    = 0;
+    queue->pool.maxcount = 0;
+    queue->pool.slabsize = 0;
+    
+    for (i = 0; i < FRAMEBUFFER_RINGSIZE; i++) {
+        queue->ring[i] = NULL;
+        queue->retring[i] = NULL;
+    }
+    if (maxsize > FRAMEBUFFER_MAXLIMIT) maxsize = FRAMEBUFFER_MAXLIMIT;
+    queue->maxsize = maxsize;
+    queue->maxduration = 0;
+    queue->maxbytes = 0;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->getduration = 0;
+    queue->getbytes = 0;
+    queue->putduration = 0;
+    queue->putbytes = 0;
+    queue->flushpos = 0;
+    queue->flushduration = 0;
+    queue->flushbytes = 0;
+    queue->reclaimpos = 0;
+    queue->rethead = 0;
+    queue->rettail = 0;
+    queue->waiters = 0;
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    queue->stats.lowwater = -1;
+    
+    return 0;
+}
 
-#if FRAMEBUFFER_PROC_TYPE == 4
-// type 4 ===================================================
+static void Framebuffer_ClearPool(FramebufferPool *pool);
 
-static Framebuffer *framebufferlistvideo;
-static Framebuffer *framebufferlistaudio;
-static Framebuffer *framebufferlistvoid;
-static Framebuffer *framebufferlistaudiowave;
-static mutexobj_t  framebuffermutex;
+static void Framebuffer_UninitQueue(FramebufferQueue *queue)
+{
+    int i;
+    
+    // no other thread uses queue here. free all remaining nodes (in list, skipped and returned)
+    for (i = 0; i < FRAMEBUFFER_RINGSIZE; i++) {
+        if (queue->ring[i]) Framebuffer_Free(queue->ring[i]);
+        queue->ring[i] = NULL;
+    }
+    while (queue->rethead != queue->rettail) {
+        Framebuffer_Free(queue->retring[queue->rethead & FRAMEBUFFER_RINGMASK]);
+        queue->rethead++;
+    }
+    queue->head = queue->tail;
+    Framebuffer_ClearPool(&queue->pool);
+    MUTEX_DESTROY(queue->pool.mutex);
+    pthread_cond_destroy(&queue->cond);
+    MUTEX_DESTROY(queue->mutex);
+}
 
 int Framebuffer_Init(void)
 {
     int ret = 0;
     
-    framebufferlistvideo = NULL;
-    framebufferlistaudio = NULL;
-    framebufferlistvoid  = NULL;
-    framebufferlistaudiowave = NULL;
-    
-    if(!MUTEX_CREATE(framebuffermutex)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueuevideo, FRAMEBUFFER_MAXBUFFER_VIDEO)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueueaudio, FRAMEBUFFER_MAXBUFFER_AUDIO)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueuevoid,  FRAMEBUFFER_MAXBUFFER_VOID)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueueaudiowave, FRAMEBUFFER_MAXBUFFER_AUDIOWAVE)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueuepresent, FRAMEBUFFER_MAXBUFFER_PRESENT)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueueapacket, FRAMEBUFFER_MAXBUFFER_APACKET)) ret = -1;
+    if (Framebuffer_InitQueue(&framebufferqueuevpacket, FRAMEBUFFER_MAXBUFFER_VPACKET)) ret = -1;
     
     return ret;
 }
 
 int Framebuffer_Uninit(void)
 {
-    int ret = 0;
+    Framebuffer_UninitQueue(&framebufferqueuevideo);
+    Framebuffer_UninitQueue(&framebufferqueueaudio);
+    Framebuffer_UninitQueue(&framebufferqueuevoid);
+    Framebuffer_UninitQueue(&framebufferqueueaudiowave);
+    Framebuffer_UninitQueue(&framebufferqueuepresent);
+    Framebuffer_UninitQueue(&framebufferqueueapacket);
+    Framebuffer_UninitQueue(&framebufferqueuevpacket);
     
-    if (framebuffermutex) {
-        MUTEX_DESTROY(framebuffermutex);
-    } else {
-        ret = -1;
+    return 0;
+}
+
+// wake up threads in Framebuffer_Wait*() (call after head or tail is changed)
+static void Framebuffer_Wakeup(FramebufferQueue *queue)
+{
+    // pairs with ATOMIC_ADD(waiters) in Framebuffer_Wait()
+    ATOMIC_FENCE();
+    if (__atomic_load_n(&queue->waiters, __ATOMIC_RELAXED)) {
+        MUTEX_LOCK(queue->mutex);
+        pthread_cond_broadcast(&queue->cond);
+        MUTEX_UNLOCK(queue->mutex);
     }
+}
+
+// 1: consumer has not discarded flushed nodes yet
+static int isFramebuffer_Flushed(FramebufferQueue *queue)
+{
+    unsigned int head, flushpos;
     
-    return ret;
+    head = ATOMIC_LOAD(queue->head);
+    flushpos = ATOMIC_LOAD(queue->flushpos);
+    
+    return ((int)(flushpos - head) > 0);
 }
 
-int Framebuffer_GetMaxSize(int type)
+int Framebuffer_ListNum(int type)
 {
-    int maxsize;
+    FramebufferQueue *queue;
+    unsigned int head, tail, flushpos;
     
-    switch (type) {
-        case FRAMEBUFFER_TYPE_AUDIO:
-            maxsize = FRAMEBUFFER_MAXBUFFER_AUDIO;
-            break;
-        case FRAMEBUFFER_TYPE_VIDEO:
-            maxsize = FRAMEBUFFER_MAXBUFFER_VIDEO;
-            break;
-        case FRAMEBUFFER_TYPE_AUDIOWAVE:
-            maxsize = FRAMEBUFFER_MAXBUFFER_AUDIOWAVE;
-            break;
-        case FRAMEBUFFER_TYPE_VOID:
-        default:
-            maxsize = FRAMEBUFFER_MAXBUFFER_VOID;
-            break;
+    queue = Framebuffer_GetQueue(type);
+    
+    // head must not move while tail is loaded (other thread may be preempted between loads)
+    do {
+        head = ATOMIC_LOAD(queue->head);
+        flushpos = ATOMIC_LOAD(queue->flushpos);
+        tail = ATOMIC_LOAD(queue->tail);
+    } while (head != ATOMIC_LOAD(queue->head));
+    if ((int)(flushpos - head) > 0) head = flushpos;
+    
+    return (int)(tail - head);
+}
+
+// total duration of list (usec)
+int64_t Framebuffer_ListDuration(int type)
+{
+    FramebufferQueue *queue;
+    int64_t getduration, putduration;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    if (isFramebuffer_Flushed(queue)) {
+        getduration = ATOMIC_LOAD(queue->flushduration);
+    } else {
+        getduration = ATOMIC_LOAD(queue->getduration);
     }
+    putduration = ATOMIC_LOAD(queue->putduration);
     
-    return maxsize;
+    return putduration - getduration;
 }
 
-Framebuffer **Framebuffer_GetList(int type)
+// total bytes of list
+int64_t Framebuffer_ListBytes(int type)
 {
-    Framebuffer **buflist;
+    FramebufferQueue *queue;
+    int64_t getbytes, putbytes;
     
-    switch (type) {
-        case FRAMEBUFFER_TYPE_AUDIO:
-            buflist = &framebufferlistaudio;
-            break;
-        case FRAMEBUFFER_TYPE_VIDEO:
-            buflist = &framebufferlistvideo;
-            break;
-        case FRAMEBUFFER_TYPE_AUDIOWAVE:
-            buflist = &framebufferlistaudiowave;
-            break;
-        case FRAMEBUFFER_TYPE_VOID:
-        default:
-            buflist = &framebufferlistvoid;
-            break;
+    queue = Framebuffer_GetQueue(type);
+    
+    if (isFramebuffer_Flushed(queue)) {
+        getbytes = ATOMIC_LOAD(queue->flushbytes);
+    } else {
+        getbytes = ATOMIC_LOAD(queue->getbytes);
     }
+    putbytes = ATOMIC_LOAD(queue->putbytes);
     
-    return buflist;
+    return putbytes - getbytes;
 }
 
-int Framebuffer_ListNum(int type)
+int isFramebuffer_Full(int type)
 {
-    Framebuffer **buflist;
-    Framebuffer *curbuf;
-    int count;
+    FramebufferQueue *queue;
     
-    buflist = Framebuffer_GetList(type);
+    queue = Framebuffer_GetQueue(type);
     
-    MUTEX_LOCK(framebuffermutex);
+    if (Framebuffer_ListNum(type) >= queue->maxsize)
+        return 1;
+    if (queue->maxduration && (Framebuffer_ListDuration(type) >= queue->maxduration))
+        return 1;
+    if (queue->maxbytes && (Framebuffer_ListBytes(type) >= queue->maxbytes))
+        return 1;
     
-    count = 0;
+    return 0;
+}
+
+// fill level of list in percent of limit (max of number, duration and bytes)
+static int Framebuffer_FillLevel(FramebufferQueue *queue, int type)
+{
+    int64_t level, tmp;
     
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (1) {
-            if (curbuf->type == type) count++;
-            if (curbuf->next == NULL) break;
-            curbuf = curbuf->next;
-        }
+    level = (int64_t)Framebuffer_ListNum(type) * 100 / queue->maxsize;
+    if (queue->maxduration) {
+        tmp = Framebuffer_ListDuration(type) * 100 / queue->maxduration;
+        if (tmp > level) level = tmp;
     }
+    if (queue->maxbytes) {
+        tmp = Framebuffer_ListBytes(type) * 100 / queue->maxbytes;
+        if (tmp > level) level = tmp;
+    }
+    if (level < 0) level = 0;
+    if (level > 100) level = 100;
+    
+    return (int)level;
+}
+
+// set limit of list.  maxnum: number of nodes  maxduration: usec (0: no limit)  maxbytes: byte (0: no limit)
+void Framebuffer_SetLimit(int type, int maxnum, int64_t maxduration, int64_t maxbytes)
+{
+    FramebufferQueue *queue;
     
-    MUTEX_UNLOCK(framebuffermutex);
+    queue = Framebuffer_GetQueue(type);
     
-    return count;
+    if (maxnum < 1) maxnum = 1;
+    if (maxnum > FRAMEBUFFER_MAXLIMIT) maxnum = FRAMEBUFFER_MAXLIMIT;
+    if (maxduration < 0) maxduration = 0;
+    if (maxbytes < 0) maxbytes = 0;
+    queue->maxsize = maxnum;
+    queue->maxduration = maxduration;
+    queue->maxbytes = maxbytes;
 }
 
-int isFramebuffer_Full(int type)
+// flush list (producer side). all nodes in list are discarded by consumer later
+void Framebuffer_Flush(int type)
 {
-    Framebuffer **buflist;
-    Framebuffer *curbuf;
-    int listnum;
-    int maxsize;
+    FramebufferQueue *queue;
     
-    buflist = Framebuffer_GetList(type);
-    maxsize = Framebuffer_GetMaxSize(type);
+    queue = Framebuffer_GetQueue(type);
     
-    MUTEX_LOCK(framebuffermutex);
+    ATOMIC_STORE(queue->flushduration, queue->putduration);
+    ATOMIC_STORE(queue->flushbytes, queue->putbytes);
+    ATOMIC_STORE(queue->flushpos, queue->tail);
+    Framebuffer_Wakeup(queue);
+}
+
+// skip flushed nodes (consumer side). Get/GetNoRemove/Sendback call this automatically
+// nodes are left in ring and freed by producer (Framebuffer_ReclaimQueue), so consumer never frees here
+// return 1: nodes are skipped
+static int Framebuffer_DiscardQueue(FramebufferQueue *queue)
+{
+    unsigned int head, flushpos;
+    int64_t duration, bytes;
+    
+    head = queue->head;
+    flushpos = ATOMIC_LOAD(queue->flushpos);
+    if ((int)(flushpos - head) <= 0) return 0;
+    
+    duration = 0;
+    bytes = 0;
+    while (head != flushpos) {
+        duration += queue->ring[head & FRAMEBUFFER_RINGMASK]->duration;
+        bytes += queue->ring[head & FRAMEBUFFER_RINGMASK]->bytes;
+        head++;
+    }
+    ATOMIC_STORE(queue->getduration, queue->getduration + duration);
+    ATOMIC_STORE(queue->getbytes, queue->getbytes + bytes);
+    ATOMIC_STORE(queue->head, head);
+    Framebuffer_Wakeup(queue);
     
-    listnum = 0;
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (1) {
-            if (curbuf->type == type) listnum++;
-            if (curbuf->next == NULL) break;
-            curbuf = curbuf->next;
+    return 1;
+}
+
+// free nodes skipped by consumer and nodes returned by consumer (producer side). Put calls this automatically
+static void Framebuffer_ReclaimQueue(FramebufferQueue *queue)
+{
+    Framebuffer *buf;
+    unsigned int head, rettail;
+    
+    // slots before head are not used by consumer, except 'head - 1' (written by Sendback).
+    // skipped nodes remain there. slots of got nodes are NULL
+    head = ATOMIC_LOAD(queue->head) - 1;
+    while ((int)(head - queue->reclaimpos) > 0) {
+        buf = queue->ring[queue->reclaimpos & FRAMEBUFFER_RINGMASK];
+        if (buf) {
+            queue->ring[queue->reclaimpos & FRAMEBUFFER_RINGMASK] = NULL;
+            Framebuffer_Free(buf);
         }
+        queue->reclaimpos++;
     }
     
-    MUTEX_UNLOCK(framebuffermutex);
+    rettail = ATOMIC_LOAD(queue->rettail);
+    while (queue->rethead != rettail) {
+        buf = queue->retring[queue->rethead & FRAMEBUFFER_RINGMASK];
+        ATOMIC_STORE(queue->rethead, queue->rethead + 1);
+        Framebuffer_Free(buf);
+    }
+}
+
+void Framebuffer_Reclaim(int type)
+{
+    Framebuffer_ReclaimQueue(Framebuffer_GetQueue(type));
+}
+
+// give used buf back to producer to free it (consumer side. for thread which must not free memory)
+void Framebuffer_Return(Framebuffer *buf)
+{
+    FramebufferQueue *queue;
+    unsigned int tail;
     
-    if (listnum >= maxsize)
-        return 1;
-    else
-        return 0;
+    queue = Framebuffer_GetQueue(buf->type);
+    
+    tail = queue->rettail;
+    if (tail - ATOMIC_LOAD(queue->rethead) >= FRAMEBUFFER_RINGSIZE) {
+        Framebuffer_Free(buf);  // (producer has not reclaimed for long time)
+        return;
+    }
+    buf->next = NULL;
+    queue->retring[tail & FRAMEBUFFER_RINGMASK] = buf;
+    ATOMIC_STORE(queue->rettail, tail + 1);
 }
 
+void Framebuffer_Discard(int type)
+{
+    Framebuffer_DiscardQueue(Framebuffer_GetQueue(type));
+}
+
+// put buf just got back to head of list (consumer side). return 0:successful  -1:list is full
+// if list is flushed after buf was got, buf is flushed too (given back to producer by Framebuffer_Return)
 int Framebuffer_Sendback(Framebuffer *buf)
 {
-    Framebuffer **buflist;
-    Framebuffer *curbuf;
-    int listnum;
-    int maxsize;
+    FramebufferQueue *queue;
+    unsigned int head, tail;
     
-    buflist = Framebuffer_GetList(buf->type);
-    maxsize = Framebuffer_GetMaxSize(buf->type);
+    queue = Framebuffer_GetQueue(buf->type);
     
-    MUTEX_LOCK(framebuffermutex);
+    Framebuffer_DiscardQueue(queue);
+    head = queue->head;
+    tail = ATOMIC_LOAD(queue->tail);
     
-    listnum = 0;
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (1) {
-            if (curbuf->type == buf->type) listnum++;
-            if (curbuf->next == NULL) break;
-            curbuf = curbuf->next;
-        }
+    // slot 'head - 1' is empty after Get. skipped node is there if list was flushed after Get
+    if (queue->ring[(head - 1) & FRAMEBUFFER_RINGMASK]) {
+        Framebuffer_Return(buf);
+        return 0;
     }
     
-    if (listnum >= maxsize) {
-        // printf("audio buffer overflow! \n");
-        MUTEX_UNLOCK(framebuffermutex);
+    // producer never fills more than RINGLIMIT (RINGSIZE - 2) slots,
+    // so slot 'head - 1' is not touched by producer here.
+    if ((int)(tail - head) >= FRAMEBUFFER_RINGLIMIT) {
         return -1;
     }
     
-    buf->next = (*buflist);
-    *buflist = buf;
-    
-    MUTEX_UNLOCK(framebuffermutex);
+    head--;
+    buf->next = NULL;
+    queue->ring[head & FRAMEBUFFER_RINGMASK] = buf;
+    ATOMIC_STORE(queue->getduration, queue->getduration - buf->duration);
+    ATOMIC_STORE(queue->getbytes, queue->getbytes - buf->bytes);
+    ATOMIC_STORE(queue->head, head);
+    Framebuffer_Wakeup(queue);
     
     return 0;
 }
 
+// put buf to tail of list (producer side). return 0:successful  -1:list is full
 int Framebuffer_Put(Framebuffer *buf)
 {
-    Framebuffer **buflist;
-    Framebuffer *curbuf;
-    int listnum;
-    int maxsize;
+    FramebufferQueue *queue;
+    unsigned int head, tail;
     
-    buflist = Framebuffer_GetList(buf->type);
-    maxsize = Framebuffer_GetMaxSize(buf->type);
+    queue = Framebuffer_GetQueue(buf->type);
     
-    MUTEX_LOCK(framebuffermutex);
+    Framebuffer_ReclaimQueue(queue);
+    tail = queue->tail;
+    head = ATOMIC_LOAD(queue->head);
     
-    listnum = 0;
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (1) {
-            if (curbuf->type == buf->type) listnum++;
-            if (curbuf->next == NULL) break;
-            curbuf = curbuf->next;
-        }
-    }
-    
-    if (listnum >= maxsize) {
+    if ((int)(tail - head) >= FRAMEBUFFER_RINGLIMIT) {
         // printf("audio buffer overflow! \n");
-        MUTEX_UNLOCK(framebuffermutex);
+        queue->stats.rejects++;
         return -1;
     }
     
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (curbuf->next != NULL )
-            curbuf = curbuf->next;
-        curbuf->next = buf;
-    } else {
-        *buflist = buf;
-    }
     buf->next = NULL;
+    queue->ring[tail & FRAMEBUFFER_RINGMASK] = buf;
+    ATOMIC_STORE(queue->putduration, queue->putduration + buf->duration);
+    ATOMIC_STORE(queue->putbytes, queue->putbytes + buf->bytes);
+    ATOMIC_STORE(queue->tail, tail + 1);
+    Framebuffer_Wakeup(queue);
     
-    MUTEX_UNLOCK(framebuffermutex);
+    queue->stats.puts++;
+    if ((int)(tail + 1 - head) > queue->stats.highwater)
+        queue->stats.highwater = (int)(tail + 1 - head);
     
     return 0;
 }
 
+// get and remove buf from head of list (consumer side). return NULL:list is empty
 Framebuffer *Framebuffer_Get(int type)
 {
+    FramebufferQueue *queue;
     Framebuffer *curbuf;
-    Framebuffer *prevbuf;
-    Framebuffer **buflist;
-    
-    buflist = Framebuffer_GetList(type);
-    
-    MUTEX_LOCK(framebuffermutex);
-    
-    prevbuf = NULL;
-    curbuf  = NULL;
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (1) {
-            if (curbuf->type == type) {
-                if (prevbuf) {
-                    prevbuf->next = curbuf->next;
-                } else {
-                    *buflist = curbuf->next;
-                }
-                curbuf->next = NULL;
-                break;
-            }
-            if (curbuf->next == NULL) {
-                curbuf = NULL;
-                break;
-            }
-            prevbuf = curbuf;
-            curbuf = curbuf->next;
-        }
-    }
+    unsigned int head, tail;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    Framebuffer_DiscardQueue(queue);
+    head = queue->head;
+    tail = ATOMIC_LOAD(queue->tail);
+    
+    if (head == tail) return NULL;
     
-    MUTEX_UNLOCK(framebuffermutex);
+    queue->stats.gets++;
+    queue->stats.histogram[Framebuffer_FillLevel(queue, type) / 10]++;
+    if ((queue->stats.lowwater < 0) || ((int)(tail - head - 1) < queue->stats.lowwater))
+        queue->stats.lowwater = (int)(tail - head - 1);
+    
+    curbuf = queue->ring[head & FRAMEBUFFER_RINGMASK];
+    queue->ring[head & FRAMEBUFFER_RINGMASK] = NULL;
+    ATOMIC_STORE(queue->getduration, queue->getduration + curbuf->duration);
+    ATOMIC_STORE(queue->getbytes, queue->getbytes + curbuf->bytes);
+    ATOMIC_STORE(queue->head, head + 1);
+    Framebuffer_Wakeup(queue);
     
     return curbuf;
 }
 
-Framebuffer *Framebuffer_GetNoRemove(int type)
+// get newest buf with pts <= time and free all older bufs (consumer side).
+// dropped: number of freed bufs (can be NULL).  return NULL:list is empty or head of list is future
+Framebuffer *Framebuffer_GetForTime(int type, int64_t time, int *dropped)
 {
-    Framebuffer *curbuf;
-    Framebuffer **buflist;
+    FramebufferQueue *queue;
+    Framebuffer *curbuf, *freelist, *buf;
+    unsigned int head, tail, last;
+    int64_t duration, bytes;
+    int num;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    if (dropped) *dropped = 0;
+    Framebuffer_DiscardQueue(queue);
+    head = queue->head;
+    tail = ATOMIC_LOAD(queue->tail);
+    
+    if (head == tail) return NULL;
+    if (queue->ring[head & FRAMEBUFFER_RINGMASK]->pts > time) return NULL;
+    
+    last = head;
+    while ((last + 1 != tail) && (queue->ring[(last + 1) & FRAMEBUFFER_RINGMASK]->pts <= time))
+        last++;
+    
+    queue->stats.gets++;
+    queue->stats.histogram[Framebuffer_FillLevel(queue, type) / 10]++;
+    if ((queue->stats.lowwater < 0) || ((int)(tail - last - 1) < queue->stats.lowwater))
+        queue->stats.lowwater = (int)(tail - last - 1);
+    
+    freelist = NULL;
+    duration = 0;
+    bytes = 0;
+    num = 0;
+    while (head != last) {
+        buf = queue->ring[head & FRAMEBUFFER_RINGMASK];
+        queue->ring[head & FRAMEBUFFER_RINGMASK] = NULL;
+        duration += buf->duration;
+        bytes += buf->bytes;
+        buf->next = freelist;
+        freelist = buf;
+        num++;
+        head++;
+    }
+    curbuf = queue->ring[last & FRAMEBUFFER_RINGMASK];
+    queue->ring[last & FRAMEBUFFER_RINGMASK] = NULL;
+    duration += curbuf->duration;
+    bytes += curbuf->bytes;
+    ATOMIC_STORE(queue->getduration, queue->getduration + duration);
+    ATOMIC_STORE(queue->getbytes, queue->getbytes + bytes);
+    ATOMIC_STORE(queue->head, last + 1);
+    Framebuffer_Wakeup(queue);
+    
+    while (freelist) {
+        buf = freelist;
+        freelist = buf->next;
+        Framebuffer_Free(buf);
+    }
+    if (dropped) *dropped = num;
     
-    buflist = Framebuffer_GetList(type);
+    return curbuf;
+}
+
+// get buf at head of list without remove (consumer side). return NULL:list is empty
+Framebuffer *Framebuffer_GetNoRemove(int type)
+{
+    FramebufferQueue *queue;
+    unsigned int head, tail;
     
-    MUTEX_LOCK(framebuffermutex);
+    queue = Framebuffer_GetQueue(type);
     
-    curbuf  = NULL;
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (curbuf->type != type) {
-            if (curbuf->next == NULL) {
-                curbuf = NULL;
-                break;
-            }
-            curbuf = curbuf->next;
-        }
-    }
+    Framebuffer_DiscardQueue(queue);
+    head = queue->head;
+    tail = ATOMIC_LOAD(queue->tail);
     
-    MUTEX_UNLOCK(framebuffermutex);
+    if (head == tail) return NULL;
     
-    return curbuf;
+    return queue->ring[head & FRAMEBUFFER_RINGMASK];
 }
 
+// pts of head of list (consumer side). return AV_NOPTS_VALUE:list is empty
 int64_t Framebuffer_GetPts(int type)
 {
     Framebuffer *curbuf;
-    Framebuffer **buflist;
-    int64_t pts;
     
-    buflist = Framebuffer_GetList(type);
+    curbuf = Framebuffer_GetNoRemove(type);
+    if (curbuf) {
+        return curbuf->pts;
+    } else {
+        return AV_NOPTS_VALUE;
+    }
+}
+
+static int Framebuffer_isReady(int type, int space)
+{
+    if (space) {
+        return !isFramebuffer_Full(type);
+    } else {
+        return (Framebuffer_ListNum(type) > 0);
+    }
+}
+
+// wait until list has data (space = 0) or has space (space = 1)
+// timeout: millisecond (negative value: wait forever). return 0:ready  -1:timeout
+static int Framebuffer_Wait(int type, int space, int timeout)
+{
+    FramebufferQueue *queue;
+    struct timeval  now, start;
+    struct timespec deadline;
+    int ready;
+    int ret;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    if (Framebuffer_isReady(type, space)) return 0;
+    if (!timeout) return -1;
+    
+    gettimeofday(&start, NULL);
+    if (timeout > 0) {
+        deadline.tv_sec  = start.tv_sec + timeout / 1000;
+        deadline.tv_nsec = start.tv_usec * 1000L + (timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    
+    MUTEX_LOCK(queue->mutex);
+    ATOMIC_ADD(queue->waiters, 1);
+    ret = 0;
+    while (!(ready = Framebuffer_isReady(type, space)) && (ret != ETIMEDOUT)) {
+        if (timeout > 0) {
+            ret = pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline);
+        } else {
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+        }
+    }
+    ATOMIC_ADD(queue->waiters, -1);
+    MUTEX_UNLOCK(queue->mutex);
     
-    MUTEX_LOCK(framebuffermutex);
+    // producer and consumer may both wait
+    gettimeofday(&now, NULL);
+    ATOMIC_ADD(queue->stats.waits, 1);
+    ATOMIC_ADD(queue->stats.waittime, (int64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec));
     
-    curbuf = NULL;
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (curbuf->type != type) {
-            if (curbuf->next == NULL) {
-                curbuf = NULL;
-                break;
+    return ready ? 0 : -1;
+}
+
+// wait data and get (consumer side). return NULL:timeout
+Framebuffer *Framebuffer_WaitGet(int type, int timeout)
+{
+    if (Framebuffer_Wait(type, 0, timeout)) return NULL;
+    return Framebuffer_Get(type);
+}
+
+// wait until list is not full (producer side). return 0:list has space  -1:timeout
+int Framebuffer_WaitSpace(int type, int timeout)
+{
+    return Framebuffer_Wait(type, 1, timeout);
+}
+
+// wait until list has data, without get (consumer side). return 0:list has data  -1:timeout
+int Framebuffer_WaitData(int type, int timeout)
+{
+    return Framebuffer_Wait(type, 0, timeout);
+}
+
+// node pool ================================================
+// free list of nodes with pre-sized payload (slab) per FRAMEBUFFER_TYPE_*.
+// Framebuffer_NewFromPool() and Framebuffer_Free() recycle nodes instead of malloc/free.
+// pool lock is only tried (never wait), so real-time thread (audio callback) never blocks.
+// when lock is busy or pool is empty/full, fall back to malloc/free.
+
+static Framebuffer *Framebuffer_Alloc(int capacity)
+{
+    Framebuffer *buf;
+    
+    buf = (Framebuffer *)malloc(sizeof(Framebuffer));
+    if (buf) {
+        buf->slab = NULL;
+        if (capacity) {
+            buf->slab = (void *)malloc(capacity);
+            if (!buf->slab) {
+                free(buf);
+                return NULL;
             }
-            curbuf = curbuf->next;
         }
+        buf->capacity = capacity;
+        buf->pool  = -1;
+        Framebuffer_MemoryReport((int)sizeof(Framebuffer) + capacity);
     }
+    return buf;
+}
+
+static void Framebuffer_Release(Framebuffer *buf)
+{
+    Framebuffer_MemoryReport(-((int)sizeof(Framebuffer) + buf->capacity));
+    if (buf->slab) free(buf->slab);
+    free(buf);
+}
+
+static void Framebuffer_ClearPool(FramebufferPool *pool)
+{
+    Framebuffer *buf;
     
-    if (curbuf) {
-        pts =  curbuf->pts;
-    } else {
-        pts =  AV_NOPTS_VALUE;
+    while (pool->freelist) {
+        buf = pool->freelist;
+        pool->freelist = buf->next;
+        Framebuffer_Release(buf);
     }
-    
-    MUTEX_UNLOCK(framebuffermutex);
-    
-    return pts;
+    pool->count = 0;
 }
 
-/*
-int Framebuffer_ClearPts(int type)
+// set payload size of pool (slabsize byte) and pre-allocate 'count' nodes
+// return number of nodes in pool
+int Framebuffer_SetPool(int type, int slabsize, int count)
 {
-    Framebuffer **buflist;
-    Framebuffer *curbuf;
-    int count;
+    FramebufferPool *pool;
+    Framebuffer *buf;
+    
+    pool = &Framebuffer_GetQueue(type)->pool;
+    if (slabsize < 0) slabsize = 0;
     
-    buflist = Framebuffer_GetList(type);
+    MUTEX_LOCK(pool->mutex);
+    if (pool->slabsize != slabsize) {
+        Framebuffer_ClearPool(pool);
+        pool->slabsize = slabsize;
+    }
+    pool->maxcount = count;
+    while (pool->count < count) {
+        buf = Framebuffer_Alloc(slabsize);
+        if (!buf) break;
+        buf->pool = type;
+        buf->next = pool->freelist;
+        pool->freelist = buf;
+        pool->count++;
+    }
+    count = pool->count;
+    MUTEX_UNLOCK(pool->mutex);
     
-    MUTEX_LOCK(framebuffermutex);
+    return count;
+}
+
+// get node from pool of 'type'. payload 'size' byte (if larger than slab size, use malloc)
+Framebuffer *Framebuffer_NewFromPool(int type, int size, int clear)
+{
+    FramebufferPool *pool;
+    Framebuffer *buf;
     
-    count = 0;
+    pool = &Framebuffer_GetQueue(type)->pool;
+    buf = NULL;
     
-    if (*buflist) {
-        curbuf = (*buflist);
-        while (1) {
-            if (curbuf->type == type) {
-                curbuf->pts = 0;
-                count++;
-            }
-            if (curbuf->next == NULL) break;
-            curbuf = curbuf->next;
+    if ((size <= pool->slabsize) && MUTEX_TRYLOCK(pool->mutex)) {
+        buf = pool->freelist;
+        if (buf) {
+            pool->freelist = buf->next;
+            pool->count--;
         }
+        MUTEX_UNLOCK(pool->mutex);
+    }
+    if (!buf) {
+        buf = Framebuffer_Alloc((size > pool->slabsize) ? size : pool->slabsize);
+        if (!buf) return NULL;
+        buf->pool = type;
     }
     
-    MUTEX_UNLOCK(framebuffermutex);
+    buf->data = buf->slab;
+    if (clear && size) memset(buf->data, 0, size);
+    buf->next  = NULL;
+    buf->pts   = 0;
+    buf->size  = size;
+    buf->bytes = size;
+    buf->duration = 0;
+    buf->type  = type;
+    buf->flags = 0;
+    buf->pos   = 0;
+    buf->playnum = 0;
+    buf->release = NULL;
+    buf->opaque  = NULL;
     
-    return count;
+    return buf;
 }
-*/
 
 Framebuffer *Framebuffer_New(int size, int clear)
 {
-    int i;
     Framebuffer *buf;
-    uint8_t *p;
     
-    buf = (Framebuffer *)malloc(sizeof(Framebuffer));
+    buf = Framebuffer_Alloc(size);
     if (buf) {
-        buf->data = NULL;
-        if (size) {
-            buf->data = (void *)malloc(size);
-            if (!buf->data) {
-                free(buf);
-                return NULL;
-            }
-            if (clear) {
-                p = (uint8_t *)buf->data;
-                for (i = 0; i < size; i++)
-                    p[i] = 0;
-            }
-        }
+        buf->data = buf->slab;
+        if (clear && size) memset(buf->data, 0, size);
         buf->next  = NULL;
         buf->pts   = 0;
         buf->size  = size;
+        buf->bytes = size;
+        buf->duration = 0;
         buf->type  = FRAMEBUFFER_TYPE_VOID;
         buf->flags = 0;
         buf->pos   = 0;
+        buf->release = NULL;
+        buf->opaque  = NULL;
     }
     return buf;
 }
 
 void Framebuffer_Free(Framebuffer *buf)
 {
+    FramebufferPool *pool;
+    
     if (buf) {
-        if (buf->data && (buf->size || (buf->flags & FRAMEBUFFER_FLAGS_DATA_FREEABLE))) {
+        if (buf->release) {  // payload is owned by user object
+            buf->release(buf);
+            buf->release = NULL;
+            buf->opaque  = NULL;
+        } else if (buf->data && (buf->data != buf->slab) && (buf->size || (buf->flags & FRAMEBUFFER_FLAGS_DATA_FREEABLE))) {
+            // 'data' is replaced by user
             free(buf->data);
         }
-        free(buf);
+        buf->data = NULL;
+        
+        if (buf->pool >= 0) {  // return to pool
+            pool = &Framebuffer_GetQueue(buf->pool)->pool;
+            if ((buf->capacity == pool->slabsize) && MUTEX_TRYLOCK(pool->mutex)) {
+                if ((buf->capacity == pool->slabsize) && (pool->count < pool->maxcount)) {
+                    buf->next = pool->freelist;
+                    pool->freelist = buf;
+                    pool->count++;
+                    buf = NULL;
+                }
+                MUTEX_UNLOCK(pool->mutex);
+            }
+        }
+        if (buf) Framebuffer_Release(buf);
     }
 }
-// end of type 4 ============================================
-#endif
 
+// memory accountant ========================================
+// framebuffer.c reports nodes and slabs. user reports other memory of media data
+// (ex. TextScreen_SetMemoryCallback(Framebuffer_MemoryReport), payload referred by node).
+// producer checks isFramebuffer_OverBudget() before decode (backpressure).
+// budget is a soft limit of payload size: nodes and slabs are counted with their header, but
+// reported memory is data size only (packet and frame data, bitmap cells). allocator overhead,
+// AVFrame/AVPacket structs, bitmap handles and row hashes are not counted. pooled nodes and
+// bitmaps stay counted while they are kept in pool. decoding may overshoot by one packet/frame.
+
+void Framebuffer_SetMemoryBudget(int64_t budget)
+{
+    if (budget < 0) budget = 0;
+    ATOMIC_STORE(framebufferbudget, budget);
+}
+
+// delta: +byte (allocated) or -byte (freed). thread safe
+void Framebuffer_MemoryReport(int delta)
+{
+    __atomic_add_fetch(&framebuffermemory, (int64_t)delta, __ATOMIC_RELAXED);
+}
+
+int64_t Framebuffer_MemoryUsage(void)
+{
+    return __atomic_load_n(&framebuffermemory, __ATOMIC_RELAXED);
+}
+
+int isFramebuffer_OverBudget(void)
+{
+    int64_t budget;
+    
+    budget = ATOMIC_LOAD(framebufferbudget);
+    
+    return (budget && (Framebuffer_MemoryUsage() >= budget));
+}
+
+// copy statistics of list 'type'
+void Framebuffer_GetStats(int type, FramebufferStats *stats)
+{
+    FramebufferQueue *queue;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    *stats = queue->stats;
+    stats->num = Framebuffer_ListNum(type);
+    stats->duration = Framebuffer_ListDuration(type);
+}
+
+void Framebuffer_ResetStats(int type)
+{
+    FramebufferQueue *queue;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    queue->stats.lowwater = -1;
+}
+
+// consumer found no data when it needs (ex. audio callback outputs silence)
+void Framebuffer_CountUnderrun(int type)
+{
+    FramebufferQueue *queue;
+    
+    queue = Framebuffer_GetQueue(type);
+    
+    ATOMIC_ADD(queue->stats.underruns, 1);
+}
+
+// write statistics of all lists to fp (one line per list)
+void Framebuffer_DumpStats(FILE *fp)
+{
+    static const char *names[] = { "void", "audio", "video", "audiowave", "present", "apacket", "vpacket" };
+    FramebufferStats stats;
+    int type, i;
+    
+    if (!fp) return;
+    
+    fprintf(fp, "memory    usage:%dKB budget:%dKB\n", (int)(Framebuffer_MemoryUsage() / 1024),
+                (int)(ATOMIC_LOAD(framebufferbudget) / 1024));
+    for (type = FRAMEBUFFER_TYPE_VOID; type <= FRAMEBUFFER_TYPE_VPACKET; type++) {
+        Framebuffer_GetStats(type, &stats);
+        fprintf(fp, "%-9s num:%d dur:%dms hw:%d lw:%d put:%"PRId64" get:%"PRId64" reject:%"PRId64
+                    " underrun:%"PRId64" wait:%"PRId64"(%"PRId64"ms) hist:",
+                    names[type], stats.num, (int)(stats.duration / 1000), stats.highwater, stats.lowwater,
+                    stats.puts, stats.gets, stats.rejects, stats.underruns, stats.waits, stats.waittime / 1000);
+        for (i = 0; i < FRAMEBUFFER_STATS_HISTOGRAM; i++)
+            fprintf(fp, "%s%"PRId64, i ? "," : "", stats.histogram[i]);
+        fprintf(fp, "\n");
+    }
+    fflush(fp);
+}
+// end of type 5 ============================================
+#endif
@@ -20,6 +20,7 @@
 #ifndef FRAMEBUFFER_FRAMEBUFFER_H
 #define FRAMEBUFFER_FRAMEBUFFER_H
 
+#include <stdio.h>
 
 // this flag is "freeable member 'void *data' by Framebuffer_Free()"
 // if not set this flag, 'data' will not free automatically by Framebuffer_Free()
@@ -29,34 +30,108 @@
 #define FRAMEBUFFER_TYPE_AUDIO       1
 #define FRAMEBUFFER_TYPE_VIDEO       2
 #define FRAMEBUFFER_TYPE_AUDIOWAVE   3
+#define FRAMEBUFFER_TYPE_PRESENT     4
+#define FRAMEBUFFER_TYPE_APACKET     5
+#define FRAMEBUFFER_TYPE_VPACKET     6
 
-#define FRAMEBUFFER_MAXBUFFER_AUDIO  32
+// default limit (number of nodes). change by Framebuffer_SetLimit()
+#define FRAMEBUFFER_MAXBUFFER_AUDIO  128
 #define FRAMEBUFFER_MAXBUFFER_VIDEO  8
 #define FRAMEBUFFER_MAXBUFFER_VOID   8
 #define FRAMEBUFFER_MAXBUFFER_AUDIOWAVE   8
+#define FRAMEBUFFER_MAXBUFFER_PRESENT     2
+#define FRAMEBUFFER_MAXBUFFER_APACKET     128
+#define FRAMEBUFFER_MAXBUFFER_VPACKET     64
+
+// each FRAMEBUFFER_TYPE_* has its own lock-free single-producer/single-consumer queue.
+// Put from one thread (producer), Get/GetNoRemove/GetPts/Sendback from one thread (consumer).
+// limit of number of nodes is max 255 (half of ring size. flushed nodes may remain in ring)
+// Framebuffer_Flush (producer) discards all nodes in O(1). consumer skips them at next Get,
+// and producer frees them at next Put or Reclaim.
+// Flush/Reclaim are producer side: other thread may call them only while producer is locked out
+// (ex. SDL_LockAudio for queue produced by SDL audio callback, video mutex for video decode thread)
 
 typedef struct Framebuffer {
     struct Framebuffer *next;
     int64_t pts;
     int type;
+    int64_t duration;  // media duration of data (usec). use for queue limit
     int size;
+    int bytes;         // memory size of data. use for queue limit (default: size)
     int pos;
     int flags;
     int playnum;
     void *data;
+    // release callback for payload owned by user object (ex. reference of decoded frame)
+    // if set, Framebuffer_Free() calls release(buf) instead of free 'data'
+    void (*release)(struct Framebuffer *buf);
+    void *opaque;     // user object for release
+    // managed by framebuffer.c
+    void *slab;       // payload owned by node (data == slab unless replaced by user)
+    int  capacity;    // size of slab
+    int  pool;        // FRAMEBUFFER_TYPE_* of pool. -1: not pooled
 } Framebuffer;
 
+// fill level histogram: [i] = i*10% to (i+1)*10% of limit, [10] = full
+#define FRAMEBUFFER_STATS_HISTOGRAM  11
+
+// queue telemetry (counters are approximate while threads are running)
+typedef struct FramebufferStats {
+    int      num;          // current number of nodes
+    int64_t  duration;     // current total duration (usec)
+    int      highwater;    // max number of nodes (sampled at Put)
+    int      lowwater;     // min number of nodes (sampled at Get)  -1: no Get yet
+    int64_t  histogram[FRAMEBUFFER_STATS_HISTOGRAM];  // fill level sampled at Get
+    int64_t  puts;
+    int64_t  gets;
+    int64_t  rejects;      // Put failed (list is full)
+    int64_t  underruns;    // consumer found list empty (see Framebuffer_CountUnderrun)
+    int64_t  waits;        // number of blocking waits (WaitGet/WaitSpace)
+    int64_t  waittime;     // total time of blocking waits (usec)
+} FramebufferStats;
+
 int Framebuffer_Init(void);
 int Framebuffer_Uninit(void);
 int Framebuffer_ListNum(int type);
+int64_t Framebuffer_ListDuration(int type);
+int64_t Framebuffer_ListBytes(int type);
 int isFramebuffer_Full(int type);
+void Framebuffer_SetLimit(int type, int maxnum, int64_t maxduration, int64_t maxbytes);
 int Framebuffer_Sendback(Framebuffer *buf);
 int Framebuffer_Put(Framebuffer *buf);
 Framebuffer *Framebuffer_Get(int type);
 Framebuffer *Framebuffer_GetNoRemove(int type);
+// newest buf with pts <= time. older bufs are freed (number of them is set to *dropped)
+Framebuffer *Framebuffer_GetForTime(int type, int64_t time, int *dropped);
 int64_t Framebuffer_GetPts(int type);
+void Framebuffer_Flush(int type);
+// skip flushed nodes now (consumer side. nodes are freed by producer)
+void Framebuffer_Discard(int type);
+// free skipped and returned nodes now (producer side. Put does this too)
+void Framebuffer_Reclaim(int type);
+// give used buf back to producer instead of Framebuffer_Free (consumer side. ex. real-time thread)
+void Framebuffer_Return(Framebuffer *buf);
+// blocking wait. timeout: millisecond (negative value: wait forever)
+Framebuffer *Framebuffer_WaitGet(int type, int timeout);
+int Framebuffer_WaitSpace(int type, int timeout);
+int Framebuffer_WaitData(int type, int timeout);
 // int Framebuffer_ClearPts(int type);
 Framebuffer *Framebuffer_New(int size, int clear);
+// node pool: pre-allocate 'count' nodes with 'slabsize' byte payload for 'type'
+int Framebuffer_SetPool(int type, int slabsize, int count);
+// get recycled node of 'type' (type member is set). Framebuffer_Free() returns it to pool
+Framebuffer *Framebuffer_NewFromPool(int type, int size, int clear);
 void Framebuffer_Free(Framebuffer *buf);
+// memory accountant (nodes of framebuffer.c + memory reported by Framebuffer_MemoryReport)
+// budget: byte (0: no limit). soft limit of payload size (overhead is not counted. see framebuffer.c)
+void Framebuffer_SetMemoryBudget(int64_t budget);
+void Framebuffer_MemoryReport(int delta);
+int64_t Framebuffer_MemoryUsage(void);
+int isFramebuffer_OverBudget(void);
+// telemetry
+void Framebuffer_GetStats(int type, FramebufferStats *stats);
+void Framebuffer_ResetStats(int type);
+void Framebuffer_CountUnderrun(int type);
+void Framebuffer_DumpStats(FILE *fp);
 
 #endif
@@ -0,0 +1,554 @@
+/*
+    framebuffer_bench.c , part of textmovie (benchmark and stress test of framebuffer.c)
+    Copyright (C) 2015-2016  by Coffey
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+    build (Linux, no FFmpeg and SDL):  make fbbench  /  make fbbench-tsan
+    usage:  fbbench [bench|stress] [seconds]
+        bench : latency (p50/p99/p999) and ops/sec of Put/Get/ListNum at some queue depth,
+                and player like threads (audio callback rate, video frame rate)
+        stress: producer/consumer threads call every API at full speed and check
+                order of data and leak of nodes (build with -fsanitize=thread)
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "framebuffer.h"
+
+#define BENCH_ITER           200000
+#define BENCH_SAMPLES        65536
+
+// audio: 2048 samples callback at 44100Hz, decoded frame 1024 samples
+#define BENCH_AUDIO_PERIOD   46440
+#define BENCH_AUDIO_FRAME    23220
+// video: 30fps decode, 60Hz presentation check
+#define BENCH_VIDEO_FRAME    33333
+#define BENCH_VIDEO_PERIOD   16666
+
+typedef struct LatencyLog {
+    uint32_t *ns;
+    int      num;
+    int      max;
+} LatencyLog;
+
+static int gStop;  // access by Bench_Stopped / Bench_SetStop
+
+static int Bench_Stopped(void)
+{
+    return __atomic_load_n(&gStop, __ATOMIC_ACQUIRE);
+}
+
+static void Bench_SetStop(int stop)
+{
+    __atomic_store_n(&gStop, stop, __ATOMIC_RELEASE);
+}
+
+static int64_t Bench_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void Bench_SleepUs(int64_t us)
+{
+    struct timespec ts;
+
+    if (us <= 0) return;
+    ts.tv_sec  = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t Bench_Rand(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int Latency_Init(LatencyLog *log, int max)
+{
+    log->ns  = (uint32_t *)malloc(sizeof(uint32_t) * max);
+    log->num = 0;
+    log->max = max;
+    return log->ns ? 0 : -1;
+}
+
+static void Latency_Add(LatencyLog *log, int64_t ns)
+{
+    if (log->num < log->max) log->ns[log->num++] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+}
+
+static int Latency_Compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void Latency_Print(const char *name, LatencyLog *log, int64_t totalns)
+{
+    double opsec;
+
+    if (!log->num) {
+        printf("  %-22s (no sample)\n", name);
+        return;
+    }
+    qsort(log->ns, log->num, sizeof(uint32_t), Latency_Compare);
+    opsec = totalns ? (double)log->num * 1e9 / (double)totalns : 0.0;
+    printf("  %-22s n=%-7d p50=%6uns p99=%6uns p999=%7uns max=%8uns", name, log->num,
+                log->ns[log->num / 2], log->ns[(int)((int64_t)log->num * 99 / 100)],
+                log->ns[(int)((int64_t)log->num * 999 / 1000)], log->ns[log->num - 1]);
+    if (opsec > 0.0) printf(" %.2fMops/s", opsec / 1e6);
+    printf("\n");
+    log->num = 0;
+}
+
+// ******** bench: single thread, fixed depth ********
+static void Bench_Depth(int depth)
+{
+    LatencyLog put, get, num;
+    Framebuffer *buf;
+    int64_t t0, t1, t2, t3, putns, getns, numns;
+    int i;
+
+    if (Latency_Init(&put, BENCH_ITER) || Latency_Init(&get, BENCH_ITER) || Latency_Init(&num, BENCH_ITER)) {
+        printf("out of memory\n");
+        exit(1);
+    }
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_VOID, depth + 1, 0, 0);
+    for (i = 0; i < depth - 1; i++) {
+        buf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_VOID, 0, 0);
+        buf->pts = i;
+        Framebuffer_Put(buf);
+    }
+
+    putns = getns = numns = 0;
+    for (i = 0; i < BENCH_ITER; i++) {
+        buf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_VOID, 0, 0);
+        buf->pts = i;
+        t0 = Bench_Now();
+        Framebuffer_Put(buf);
+        t1 = Bench_Now();
+        Framebuffer_ListNum(FRAMEBUFFER_TYPE_VOID);
+        t2 = Bench_Now();
+        buf = Framebuffer_Get(FRAMEBUFFER_TYPE_VOID);
+        t3 = Bench_Now();
+        Framebuffer_Free(buf);
+        Latency_Add(&put, t1 - t0);
+        Latency_Add(&num, t2 - t1);
+        Latency_Add(&get, t3 - t2);
+        putns += t1 - t0;
+        numns += t2 - t1;
+        getns += t3 - t2;
+    }
+    Framebuffer_Flush(FRAMEBUFFER_TYPE_VOID);
+    Framebuffer_Discard(FRAMEBUFFER_TYPE_VOID);
+    Framebuffer_Reclaim(FRAMEBUFFER_TYPE_VOID);
+
+    printf("depth %d\n", depth);
+    Latency_Print("Put", &put, putns);
+    Latency_Print("ListNum", &num, numns);
+    Latency_Print("Get", &get, getns);
+    free(put.ns);
+    free(get.ns);
+    free(num.ns);
+}
+
+// ******** bench: producer/consumer threads at full speed ********
+static void *Throughput_Producer(void *arg)
+{
+    Framebuffer *buf;
+    int64_t *count = (int64_t *)arg;
+
+    while (!Bench_Stopped()) {
+        buf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_VOID, 0, 0);
+        if (!buf) continue;
+        while (Framebuffer_Put(buf)) {
+            if (Bench_Stopped()) {
+                Framebuffer_Free(buf);
+                return NULL;
+            }
+            Framebuffer_WaitSpace(FRAMEBUFFER_TYPE_VOID, 10);
+        }
+        (*count)++;
+    }
+    return NULL;
+}
+
+static void *Throughput_Consumer(void *arg)
+{
+    Framebuffer *buf;
+    int64_t *count = (int64_t *)arg;
+
+    while (!Bench_Stopped()) {
+        buf = Framebuffer_WaitGet(FRAMEBUFFER_TYPE_VOID, 10);
+        if (buf) {
+            Framebuffer_Free(buf);
+            (*count)++;
+        }
+    }
+    return NULL;
+}
+
+static void Bench_Throughput(int depth, int ms)
+{
+    pthread_t ptid, ctid;
+    int64_t putcount, getcount, t0, t1;
+
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_VOID, depth, 0, 0);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_VOID, 0, depth + 2);
+    putcount = getcount = 0;
+    Bench_SetStop(0);
+    t0 = Bench_Now();
+    pthread_create(&ptid, NULL, Throughput_Producer, &putcount);
+    pthread_create(&ctid, NULL, Throughput_Consumer, &getcount);
+    Bench_SleepUs((int64_t)ms * 1000);
+    Bench_SetStop(1);
+    pthread_join(ptid, NULL);
+    pthread_join(ctid, NULL);
+    t1 = Bench_Now();
+    Framebuffer_Flush(FRAMEBUFFER_TYPE_VOID);
+    Framebuffer_Discard(FRAMEBUFFER_TYPE_VOID);
+    Framebuffer_Reclaim(FRAMEBUFFER_TYPE_VOID);
+
+    printf("  depth %-3d  put %.2fMops/s  get %.2fMops/s\n", depth,
+                (double)putcount * 1e3 / (double)(t1 - t0), (double)getcount * 1e3 / (double)(t1 - t0));
+}
+
+// ******** bench: player like threads ********
+typedef struct PlayerLog {
+    LatencyLog audioput, audioget, videoput, videoget, listnum;
+    int64_t    underrun;
+    int64_t    dropped;
+} PlayerLog;
+
+static void *Player_Decoder(void *arg)
+{
+    PlayerLog *log = (PlayerLog *)arg;
+    Framebuffer *buf;
+    int64_t apts, vpts, t0, start;
+
+    apts = vpts = 0;
+    start = Bench_Now();
+    while (!Bench_Stopped()) {
+        // decode audio while buffer has space (same as main loop of textmovie)
+        while (!isFramebuffer_Full(FRAMEBUFFER_TYPE_AUDIO) && !Bench_Stopped()) {
+            buf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_AUDIO, 4096, 0);
+            if (!buf) break;
+            buf->pts = apts;
+            buf->duration = BENCH_AUDIO_FRAME;
+            apts += BENCH_AUDIO_FRAME;
+            t0 = Bench_Now();
+            if (Framebuffer_Put(buf)) Framebuffer_Free(buf);
+            Latency_Add(&log->audioput, Bench_Now() - t0);
+        }
+        // decode video up to presentation time + buffer
+        while (!isFramebuffer_Full(FRAMEBUFFER_TYPE_VIDEO) && (vpts < (Bench_Now() - start) / 1000 + 500000) && !Bench_Stopped()) {
+            buf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_VIDEO, 0, 0);
+            if (!buf) break;
+            buf->pts = vpts;
+            buf->duration = BENCH_VIDEO_FRAME;
+            vpts += BENCH_VIDEO_FRAME;
+            t0 = Bench_Now();
+            if (Framebuffer_Put(buf)) Framebuffer_Free(buf);
+            Latency_Add(&log->videoput, Bench_Now() - t0);
+        }
+        Framebuffer_WaitSpace(FRAMEBUFFER_TYPE_AUDIO, 10);
+    }
+    return NULL;
+}
+
+static void *Player_AudioCallback(void *arg)
+{
+    PlayerLog *log = (PlayerLog *)arg;
+    Framebuffer *buf;
+    int64_t t0, next;
+    int need;
+
+    next = Bench_Now();
+    while (!Bench_Stopped()) {
+        next += (int64_t)BENCH_AUDIO_PERIOD * 1000;
+        Bench_SleepUs((next - Bench_Now()) / 1000);
+        // one callback consumes 2 decoded frames
+        for (need = 2; need > 0; need--) {
+            t0 = Bench_Now();
+            buf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIO);
+            Latency_Add(&log->audioget, Bench_Now() - t0);
+            if (!buf) {
+                log->underrun++;
+                Framebuffer_CountUnderrun(FRAMEBUFFER_TYPE_AUDIO);
+                break;
+            }
+            Framebuffer_Free(buf);
+        }
+    }
+    return NULL;
+}
+
+static void *Player_Presenter(void *arg)
+{
+    PlayerLog *log = (PlayerLog *)arg;
+    Framebuffer *buf;
+    int64_t t0, start;
+    int dropped;
+
+    start = Bench_Now();
+    while (!Bench_Stopped()) {
+        Bench_SleepUs(BENCH_VIDEO_PERIOD);
+        t0 = Bench_Now();
+        Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIO);
+        Latency_Add(&log->listnum, Bench_Now() - t0);
+        t0 = Bench_Now();
+        buf = Framebuffer_GetForTime(FRAMEBUFFER_TYPE_VIDEO, (t0 - start) / 1000, &dropped);
+        Latency_Add(&log->videoget, Bench_Now() - t0);
+        log->dropped += dropped;
+        Framebuffer_Free(buf);
+    }
+    return NULL;
+}
+
+static void Bench_Player(int sec)
+{
+    PlayerLog log;
+    pthread_t dtid, atid, vtid;
+
+    memset(&log, 0, sizeof(log));
+    if (Latency_Init(&log.audioput, BENCH_SAMPLES) || Latency_Init(&log.audioget, BENCH_SAMPLES) ||
+        Latency_Init(&log.videoput, BENCH_SAMPLES) || Latency_Init(&log.videoget, BENCH_SAMPLES) ||
+        Latency_Init(&log.listnum, BENCH_SAMPLES)) {
+        printf("out of memory\n");
+        exit(1);
+    }
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_AUDIO, FRAMEBUFFER_MAXBUFFER_AUDIO, 750000, 0);
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_VIDEO, FRAMEBUFFER_MAXBUFFER_VIDEO, 0, 0);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_AUDIO, 4096, 40);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_VIDEO, 0, FRAMEBUFFER_MAXBUFFER_VIDEO + 2);
+    Framebuffer_ResetStats(FRAMEBUFFER_TYPE_AUDIO);
+    Framebuffer_ResetStats(FRAMEBUFFER_TYPE_VIDEO);
+
+    Bench_SetStop(0);
+    pthread_create(&dtid, NULL, Player_Decoder, &log);
+    pthread_create(&atid, NULL, Player_AudioCallback, &log);
+    pthread_create(&vtid, NULL, Player_Presenter, &log);
+    Bench_SleepUs((int64_t)sec * 1000000);
+    Bench_SetStop(1);
+    pthread_join(dtid, NULL);
+    pthread_join(atid, NULL);
+    pthread_join(vtid, NULL);
+
+    printf("player threads %dsec (audio callback %dus, video %dus)\n", sec, BENCH_AUDIO_PERIOD, BENCH_VIDEO_FRAME);
+    Latency_Print("Put(audio)", &log.audioput, 0);
+    Latency_Print("Get(audio callback)", &log.audioget, 0);
+    Latency_Print("Put(video)", &log.videoput, 0);
+    Latency_Print("GetForTime(video)", &log.videoget, 0);
+    Latency_Print("ListNum(other thread)", &log.listnum, 0);
+    printf("  underrun:%"PRId64"  video dropped:%"PRId64"\n", log.underrun, log.dropped);
+    Framebuffer_DumpStats(stdout);
+
+    free(log.audioput.ns);
+    free(log.audioget.ns);
+    free(log.videoput.ns);
+    free(log.videoget.ns);
+    free(log.listnum.ns);
+}
+
+// ******** stress ********
+static int64_t gStressAlloc;    // number of payloads (release callback counts free)
+static int64_t gStressRelease;
+static int     gStressError;
+
+static void Stress_Release(Framebuffer *buf)
+{
+    free(buf->opaque);
+    __atomic_add_fetch(&gStressRelease, 1, __ATOMIC_RELAXED);
+}
+
+static void *Stress_Producer(void *arg)
+{
+    int type = *(int *)arg;
+    Framebuffer *buf;
+    uint32_t rnd = 0x12345678 + type;
+    int64_t pts = 0;
+
+    while (!Bench_Stopped()) {
+        buf = Framebuffer_NewFromPool(type, (Bench_Rand(&rnd) & 1) ? 64 : 0, 0);
+        if (!buf) continue;
+        buf->pts = pts++;
+        buf->duration = 1000;
+        buf->opaque = malloc(16);
+        buf->release = Stress_Release;
+        __atomic_add_fetch(&gStressAlloc, 1, __ATOMIC_RELAXED);
+        if (Framebuffer_Put(buf)) {
+            Framebuffer_Free(buf);
+            Framebuffer_WaitSpace(type, 1);
+        }
+        if (isFramebuffer_Full(type)) Framebuffer_WaitSpace(type, 1);
+        if (!(Bench_Rand(&rnd) % 997)) Framebuffer_Flush(type);
+    }
+    return NULL;
+}
+
+static void *Stress_Consumer(void *arg)
+{
+    int type = *(int *)arg;
+    Framebuffer *buf;
+    uint32_t rnd = 0x9abcdef0 + type;
+    int64_t lastpts = -1;
+    int dropped;
+
+    while (!Bench_Stopped()) {
+        switch (Bench_Rand(&rnd) % 5) {
+            case 0:
+                buf = Framebuffer_WaitGet(type, 1);
+                break;
+            case 1:
+                buf = Framebuffer_GetNoRemove(type);
+                if (buf && (Framebuffer_GetPts(type) != buf->pts)) gStressError++;
+                buf = NULL;
+                break;
+            case 2:
+                buf = Framebuffer_GetForTime(type, lastpts + (Bench_Rand(&rnd) % 8), &dropped);
+                break;
+            case 3:  // get and send back
+                buf = Framebuffer_Get(type);
+                if (buf) {
+                    if (buf->pts <= lastpts) gStressError++;
+                    if (Framebuffer_Sendback(buf)) Framebuffer_Return(buf);
+                    buf = NULL;
+                }
+                break;
+            default:
+                buf = Framebuffer_Get(type);
+                break;
+        }
+        if (buf) {
+            if (buf->pts <= lastpts) {
+                printf("  order error: type %d pts %"PRId64" after %"PRId64"\n", type, buf->pts, lastpts);
+                gStressError++;
+            }
+            lastpts = buf->pts;
+            if (Bench_Rand(&rnd) & 1) Framebuffer_Return(buf);
+            else Framebuffer_Free(buf);
+        }
+    }
+    return NULL;
+}
+
+static void *Stress_Monitor(void *arg)
+{
+    int n, type;
+
+    (void)arg;
+    while (!Bench_Stopped()) {
+        for (type = FRAMEBUFFER_TYPE_AUDIO; type <= FRAMEBUFFER_TYPE_VIDEO; type++) {
+            n = Framebuffer_ListNum(type);
+            if ((n < 0) || (n > 510)) {
+                printf("  ListNum error: type %d num %d\n", type, n);
+                gStressError++;
+            }
+            isFramebuffer_Full(type);
+            Framebuffer_ListDuration(type);
+            Framebuffer_ListBytes(type);
+        }
+    }
+    return NULL;
+}
+
+static int Stress_Run(int sec)
+{
+    static int types[2] = { FRAMEBUFFER_TYPE_AUDIO, FRAMEBUFFER_TYPE_VIDEO };
+    pthread_t ptid[2], ctid[2], mtid;
+    int i;
+
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_AUDIO, 64, 32000, 0);
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_VIDEO, 8, 0, 0);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_AUDIO, 64, 16);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_VIDEO, 0, 4);
+
+    Bench_SetStop(0);
+    for (i = 0; i < 2; i++) {
+        pthread_create(&ptid[i], NULL, Stress_Producer, &types[i]);
+        pthread_create(&ctid[i], NULL, Stress_Consumer, &types[i]);
+    }
+    pthread_create(&mtid, NULL, Stress_Monitor, NULL);
+    Bench_SleepUs((int64_t)sec * 1000000);
+    Bench_SetStop(1);
+    for (i = 0; i < 2; i++) {
+        pthread_join(ptid[i], NULL);
+        pthread_join(ctid[i], NULL);
+    }
+    pthread_join(mtid, NULL);
+
+    Framebuffer_DumpStats(stdout);
+    Framebuffer_Uninit();  // frees remaining nodes
+
+    printf("stress %dsec: alloc %"PRId64" release %"PRId64" error %d\n", sec, gStressAlloc, gStressRelease, gStressError);
+    if ((gStressAlloc != gStressRelease) || gStressError) {
+        printf("stress: FAILED\n");
+        return 1;
+    }
+    printf("stress: OK\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int depths[] = { 1, 8, 32, 128, 255 };
+    int sec = 2;
+    int i, ret;
+
+    if (argc > 2) sec = atoi(argv[2]);
+    if (sec < 1) sec = 1;
+
+    if (Framebuffer_Init()) {
+        printf("Can not initialize framebuffer\n");
+        return 1;
+    }
+
+    if ((argc > 1) && !strcmp(argv[1], "stress")) {
+        return Stress_Run(sec);
+    }
+
+    printf("single thread (Put, ListNum, Get at fixed depth)\n");
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_VOID, 0, 258);
+    for (i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); i++)
+        Bench_Depth(depths[i]);
+
+    printf("producer/consumer threads at full speed\n");
+    for (i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); i++)
+        Bench_Throughput(depths[i], 300);
+
+    Bench_Player(sec);
+
+    ret = Framebuffer_Uninit();
+    return ret;
+}
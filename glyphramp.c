@@ -0,0 +1,75 @@
+/*
+    glyphramp.c , part of textmovie (play movie with console. for Windows)
+    Copyright (C) 2015-2016  by Coffey
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "glyphramp.h"
+
+static const char *gGlyphRampPreset[NUMBER_OF_GLYPHRAMP_TYPE] = {
+    " .-:+*H#",
+    " .'`-:;~=+*ox%#@",
+    " .'`^\",:;Il!i><~+_-?][}{1)(|\\/tfjrxnuvczXYUJCLQ0OZmwqpdbkhao*#MW&8%B@$",
+};
+
+const char *GlyphRamp_Preset(int type)
+{
+    if ((type < 0) || (type >= NUMBER_OF_GLYPHRAMP_TYPE)) type = GLYPHRAMP_8LEVEL;
+    return gGlyphRampPreset[type];
+}
+
+int GlyphRamp_Build(GlyphRamp *ramp, const char *chars, int gamma, int contrast)
+{
+    int i, levels, level;
+    double v;
+    
+    if (!ramp || !chars) return -1;
+    levels = strlen(chars);
+    if ((levels < 2) || (levels > GLYPHRAMP_MAXLEVEL)) return -1;
+    for (i = 0; i < levels; i++) {
+        if ((chars[i] < 0x20) || (chars[i] > 0x7e)) return -1;
+    }
+    if (gamma < 10) gamma = 10;
+    if (contrast < 0) contrast = 0;
+    
+    memcpy(ramp->ramp, chars, levels + 1);
+    ramp->levels = levels;
+    
+    // luma to level. (i + 0.5) / 256: linear curve is same as i * levels / 256
+    for (i = 0; i < 256; i++) {
+        v = (i + 0.5) / 256.0;
+        if (contrast != 100) v = (v - 0.5) * contrast / 100.0 + 0.5;
+        if (v < 0.0) v = 0.0;
+        if (v > 1.0) v = 1.0;
+        if (gamma != 100) v = pow(v, 100.0 / gamma);
+        level = (int)(v * levels);
+        if (level >= levels) level = levels - 1;
+        ramp->table[i] = chars[level];
+    }
+    
+    // negative: level k to level (levels - 1 - k)
+    for (i = 0; i < 256; i++) {
+        ramp->negative[i] = chars[1];
+    }
+    for (i = 0; i < levels; i++) {
+        ramp->negative[(unsigned char)chars[i]] = chars[levels - 1 - i];
+    }
+    
+    return 0;
+}
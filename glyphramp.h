@@ -0,0 +1,49 @@
+/*
+    glyphramp.h , part of textmovie (play movie with console. for Windows)
+    Copyright (C) 2015-2016  by Coffey
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLYPHRAMP_GLYPHRAMP_H
+#define GLYPHRAMP_GLYPHRAMP_H
+
+// max number of levels (printable ASCII characters)
+#define GLYPHRAMP_MAXLEVEL  95
+
+enum GlyphRampType {
+    GLYPHRAMP_8LEVEL,     // " .-:+*H#" (original)
+    GLYPHRAMP_16LEVEL,
+    GLYPHRAMP_70LEVEL,
+    NUMBER_OF_GLYPHRAMP_TYPE,
+};
+
+typedef struct GlyphRamp {
+    // characters from dark to bright
+    char ramp[GLYPHRAMP_MAXLEVEL + 1];
+    // number of levels (length of ramp)
+    int  levels;
+    // luma (0-255) to character  (use with TextScreen_MapBitmap)
+    char table[256];
+    // character to character of inverted level (negative image. not ramp character: ramp[1])
+    char negative[256];
+} GlyphRamp;
+
+// characters of preset ramp 'type' (dark to bright)
+const char *GlyphRamp_Preset(int type);
+// build tables of ramp 'chars' (2 - GLYPHRAMP_MAXLEVEL printable characters, dark to bright)
+// gamma, contrast: percent (100: linear)   return 0:successful  -1:invalid ramp (ramp is not changed)
+int GlyphRamp_Build(GlyphRamp *ramp, const char *chars, int gamma, int contrast);
+
+#endif
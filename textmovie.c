@@ -54,6 +54,7 @@
 #include "framebuffer.h"
 #include "playlist.h"
 #include "audiowave.h"
+#include "glyphramp.h"
 #include "version.h"
 
 #include <pthread.h>
@@ -65,12 +66,19 @@ typedef pthread_mutex_t   mutexobj_t;
 
 
 #define DEFAULT_PLAYBACK_AUDIO_SAMPLE  44100
+// size of status line buffer of presenter node
+#define PRESENT_STATUS_SIZE  128
+
+// levels of video decode degradation (see VideoStream_SkipControl)
+#define DECODE_SKIP_LEVELS   4
 
 // use timeGetTime() instead of GetTimeCount() (include mmsystem.h)
 #define GetTickCount timeGetTime
 
-// video codec, filter context
+// format context (one context for audio and video. packets are read by demux thread)
 static AVFormatContext *fmt_ctx = NULL;
+
+// video codec, filter context
 static AVCodecContext *dec_ctx = NULL;
 static AVFilterContext *buffersink_ctx;
 static AVFilterContext *buffersrc_ctx;
@@ -80,7 +88,6 @@ static AVFrame *frame;
 static AVFrame *filter_frame;
 
 // audio codec, filter context
-static AVFormatContext *afmt_ctx = NULL;
 static AVCodecContext *adec_ctx = NULL;
 static AVFilterContext *abuffersink_ctx;
 static AVFilterContext *abuffersrc_ctx;
@@ -123,12 +130,42 @@ static int     gFrameDrop = 0;
 static int     gBarMode = 0;
 static int     gSampleRate = DEFAULT_PLAYBACK_AUDIO_SAMPLE;
 static int     gInitSampleRate = DEFAULT_PLAYBACK_AUDIO_SAMPLE;
+static int     gAudioBufferTime = 750;  // msec
+static int     gAudioBufferSize = 0;    // KByte  0: no limit
+static int     gVideoBufferTime = 0;    // msec   0: no limit
+static int     gVideoBufferNum  = FRAMEBUFFER_MAXBUFFER_VIDEO;
+static int     gMemoryBudget = 0;       // MByte  0: no limit
+static char    gStatsLog[MAX_PATH];     // framebuffer statistics log file  "": no log
+static int     gStatsInterval = 10;     // sec
+static int     gRenderingMethod = TEXTSCREEN_RENDERING_METHOD_DIFF;
+static int     gFramePacing = 1;        // 1: skip frames console can not keep up with
+static int     gPaceInterval = 0;       // usec  sustainable interval of frames (measured by presenter)
+static int     gPaceBytesPerSec = 0;    // measured console throughput
+static int     gPaceFrameBytes = 0;     // average output size of frame
+static GlyphRamp gGlyphRamp;            // luma to character of video frame (and negative for print screen)
+static char    gGlyphRampChars[GLYPHRAMP_MAXLEVEL + 1];  // "": use gGlyphRampType
+static int     gGlyphRampType = GLYPHRAMP_8LEVEL;
+static int     gGlyphGamma = 100;       // percent
+static int     gGlyphContrast = 100;    // percent
+static int     gThreadCount = 0;        // threads of video decoder  0: auto (number of cores)
+static int     gThreadType = 0;         // (0)frame and slice (1)frame (2)slice
+static int     gSeekedVideo = 0;        // seeked. reset by video decode thread
+static int     gDecodeSkip = 1;         // 1: skip decoding work of late video
+static int     gDecodeSkipLevel = 0;    // current level (0 - DECODE_SKIP_LEVELS-1. video decode thread)
+static int     gReadDoneDemux = 0;      // end of file. set by demux thread after last packet
+static Framebuffer *gDemuxPending = NULL;  // packet waiting for space of its queue (demux thread)
 
 //static int64_t gCallPrevTime = 0;  // test for callback
 //static int64_t gCallDiff = 0;      // test for callback
 
 static pthread_t  gAudioWaveTid;
 static mutexobj_t gMutexBitmapWave;
+static pthread_t  gPresentTid;
+static mutexobj_t gMutexScreen;     // console output (presenter thread and main thread)
+static pthread_t  gVideoTid;
+static mutexobj_t gMutexVideo;      // video stream and decoder (video decode thread and main thread)
+static pthread_t  gDemuxTid;
+static mutexobj_t gMutexDemux;      // format context and packet queues (demux thread and main thread)
 
 
 typedef struct MediaInfo {
@@ -182,41 +219,116 @@ void ReadInitFile(const char *lpFileName)
     gInitSampleRate = (int)GetPrivateProfileInt(lpAppName, "SampleRate", DEFAULT_PLAYBACK_AUDIO_SAMPLE, lpFileName);
     if (gInitSampleRate < 22050) gInitSampleRate = 22050;
     if (gInitSampleRate > 48000) gInitSampleRate = 48000;
+    
+    gAudioBufferTime = (int)GetPrivateProfileInt(lpAppName, "AudioBufferTime", 750, lpFileName);
+    if (gAudioBufferTime < 100) gAudioBufferTime = 100;
+    if (gAudioBufferTime > 5000) gAudioBufferTime = 5000;
+    
+    gAudioBufferSize = (int)GetPrivateProfileInt(lpAppName, "AudioBufferSize", 0, lpFileName);
+    if (gAudioBufferSize < 0) gAudioBufferSize = 0;
+    if (gAudioBufferSize > 65536) gAudioBufferSize = 65536;
+    
+    gVideoBufferTime = (int)GetPrivateProfileInt(lpAppName, "VideoBufferTime", 0, lpFileName);
+    if (gVideoBufferTime < 0) gVideoBufferTime = 0;
+    if (gVideoBufferTime > 5000) gVideoBufferTime = 5000;
+    
+    gVideoBufferNum = (int)GetPrivateProfileInt(lpAppName, "VideoBufferNum", FRAMEBUFFER_MAXBUFFER_VIDEO, lpFileName);
+    if (gVideoBufferNum < 2) gVideoBufferNum = 2;
+    if (gVideoBufferNum > 128) gVideoBufferNum = 128;
+    
+    gMemoryBudget = (int)GetPrivateProfileInt(lpAppName, "MemoryBudget", 0, lpFileName);
+    if (gMemoryBudget < 0) gMemoryBudget = 0;
+    if (gMemoryBudget > 4096) gMemoryBudget = 4096;
+    
+    GetPrivateProfileString(lpAppName, "StatsLog", "", gStatsLog, sizeof(gStatsLog), lpFileName);
+    
+    gStatsInterval = (int)GetPrivateProfileInt(lpAppName, "StatsInterval", 10, lpFileName);
+    if (gStatsInterval < 1) gStatsInterval = 1;
+    if (gStatsInterval > 3600) gStatsInterval = 3600;
+    
+    gRenderingMethod = (int)GetPrivateProfileInt(lpAppName, "RenderingMethod", TEXTSCREEN_RENDERING_METHOD_DIFF, lpFileName);
+    if ((gRenderingMethod < 0) || (gRenderingMethod >= TEXTSCREEN_RENDERING_METHOD_NB))
+        gRenderingMethod = TEXTSCREEN_RENDERING_METHOD_DIFF;
+    
+    gFramePacing = (GetPrivateProfileInt(lpAppName, "FramePacing", 1, lpFileName) != 0);
+    
+    GetPrivateProfileString(lpAppName, "GlyphRamp", "", gGlyphRampChars, sizeof(gGlyphRampChars), lpFileName);
+    
+    gGlyphRampType = (int)GetPrivateProfileInt(lpAppName, "GlyphRampType", GLYPHRAMP_8LEVEL, lpFileName);
+    if ((gGlyphRampType < 0) || (gGlyphRampType >= NUMBER_OF_GLYPHRAMP_TYPE)) gGlyphRampType = GLYPHRAMP_8LEVEL;
+    
+    gGlyphGamma = (int)GetPrivateProfileInt(lpAppName, "GlyphGamma", 100, lpFileName);
+    if (gGlyphGamma < 10) gGlyphGamma = 10;
+    if (gGlyphGamma > 1000) gGlyphGamma = 1000;
+    
+    gGlyphContrast = (int)GetPrivateProfileInt(lpAppName, "GlyphContrast", 100, lpFileName);
+    if (gGlyphContrast < 0) gGlyphContrast = 0;
+    if (gGlyphContrast > 1000) gGlyphContrast = 1000;
+    
+    gThreadCount = (int)GetPrivateProfileInt(lpAppName, "ThreadCount", 0, lpFileName);
+    if (gThreadCount < 0) gThreadCount = 0;
+    if (gThreadCount > 16) gThreadCount = 16;
+    
+    gThreadType = (int)GetPrivateProfileInt(lpAppName, "ThreadType", 0, lpFileName);
+    if ((gThreadType < 0) || (gThreadType > 2)) gThreadType = 0;
+    
+    gDecodeSkip = (GetPrivateProfileInt(lpAppName, "DecodeSkip", 1, lpFileName) != 0);
+}
+
+// set queue limit of audio/video framebuffer (call after Framebuffer_Init)
+void Set_BufferLimit(void)
+{
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_AUDIO, FRAMEBUFFER_MAXBUFFER_AUDIO,
+                         (int64_t)gAudioBufferTime * 1000, (int64_t)gAudioBufferSize * 1024);
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_VIDEO, gVideoBufferNum,
+                         (int64_t)gVideoBufferTime * 1000, 0);
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_APACKET, FRAMEBUFFER_MAXBUFFER_APACKET, 0, 0);
+    Framebuffer_SetLimit(FRAMEBUFFER_TYPE_VPACKET, FRAMEBUFFER_MAXBUFFER_VPACKET, 0, 0);
+    Framebuffer_SetMemoryBudget((int64_t)gMemoryBudget * 1024 * 1024);
+}
+
+// make luma to character table of video frame (GlyphRamp or GlyphRampType in ini file)
+void Set_GlyphTable(void)
+{
+    if (gGlyphRampChars[0] && !GlyphRamp_Build(&gGlyphRamp, gGlyphRampChars, gGlyphGamma, gGlyphContrast))
+        return;
+    GlyphRamp_Build(&gGlyphRamp, GlyphRamp_Preset(gGlyphRampType), gGlyphGamma, gGlyphContrast);
+}
+
+// 1: do not decode more data of 'type' (list is full, or over memory budget)
+// memory budget never stops decoding when list is empty (to keep playing)
+int isCuedata_Full(int type)
+{
+    if (isFramebuffer_Full(type)) return 1;
+    if (isFramebuffer_OverBudget() && Framebuffer_ListNum(type)) return 1;
+    return 0;
 }
 
+// flush cue data (main thread. producer of 'type' must be main thread or locked out: gMutexVideo for VIDEO)
+// AUDIOWAVE is produced by SDL callback. it is locked here (no effect if audio device is closed)
 void Clear_Cuedata(int type)
 {
-    Framebuffer *buf;
+    if (type == FRAMEBUFFER_TYPE_AUDIOWAVE) SDL_LockAudio();
+    Framebuffer_Flush(type);
     
     switch (type) {
-        case FRAMEBUFFER_TYPE_AUDIO:
-            while(Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIO)) {
-                buf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIO);
-                Framebuffer_Free(buf);
-            }
-            break;
         case FRAMEBUFFER_TYPE_VIDEO:
-            while(Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO)) {
-                buf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
-                TextScreen_FreeBitmap((TextScreenBitmap *)buf->data);
-                Framebuffer_Free(buf);
-            }
-            break;
         case FRAMEBUFFER_TYPE_VOID:
-            while(Framebuffer_ListNum(FRAMEBUFFER_TYPE_VOID)) {
-                buf = Framebuffer_Get(FRAMEBUFFER_TYPE_VOID);
-                Framebuffer_Free(buf);
-            }
+            // main thread is consumer too. free now
+            Framebuffer_Discard(type);
+            Framebuffer_Reclaim(type);
             break;
-        case FRAMEBUFFER_TYPE_AUDIOWAVE:
-            while(Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIOWAVE)) {
-                buf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIOWAVE);
-                Framebuffer_Free(buf);
-            }
+        case FRAMEBUFFER_TYPE_APACKET:    // consumer is main thread
+        case FRAMEBUFFER_TYPE_VPACKET:    // consumer is video decode thread (call with gMutexVideo)
+            Framebuffer_Discard(type);
+            Framebuffer_Reclaim(type);
             break;
+        case FRAMEBUFFER_TYPE_AUDIO:      // skipped by SDL callback, freed at next Put/Reclaim
+        case FRAMEBUFFER_TYPE_AUDIOWAVE:  // skipped by AudioWave thread, freed at next Put/Reclaim
         default:
             break;
     }
+    if (type == FRAMEBUFFER_TYPE_AUDIOWAVE) SDL_UnlockAudio();
 }
 
 void GetItunsmpbValues(char *smpbstr, uint32_t *edelay, uint32_t *zeropad, uint64_t *length)
@@ -426,18 +538,16 @@ int isMediaFile(const wchar_t *filename, MediaInfo *minfo)
     return (isAudio || isVideo);
 }
 
-int VideoStream_OpenFile(const wchar_t *filename)
+// open input file (fmt_ctx is shared by audio and video decoder)
+int Stream_OpenInput(const wchar_t *filename)
 {
     int ret;
-    AVCodec *dec;
     char filename_utf8[MAX_PATH * 2];
     
     //CP932toUTF8(filename_utf8, sizeof(filename_utf8), filename);
     WideCharToMultiByte(CP_UTF8, 0, filename, -1, filename_utf8, sizeof(filename_utf8), NULL, NULL);
     
-    video_stream_index = -1;
     fmt_ctx = NULL;
-    dec_ctx = NULL;
     
     //if ((ret = avformat_open_input(&fmt_ctx, filename, NULL, NULL)) < 0) {
     if ((ret = avformat_open_input(&fmt_ctx, filename_utf8, NULL, NULL)) < 0) {
@@ -451,9 +561,20 @@ int VideoStream_OpenFile(const wchar_t *filename)
         return ret;
     }
     
+    return 0;
+}
+
+// open video decoder of fmt_ctx (call after Stream_OpenInput)
+int VideoStream_OpenDecoder(void)
+{
+    int ret;
+    AVCodec *dec;
+    
+    video_stream_index = -1;
+    dec_ctx = NULL;
+    
     if ((ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot find a video stream in the input file\n");
-        avformat_close_input(&fmt_ctx);
         return ret;
     }
     
@@ -461,51 +582,48 @@ int VideoStream_OpenFile(const wchar_t *filename)
     dec_ctx = fmt_ctx->streams[video_stream_index]->codec;
     av_opt_set_int(dec_ctx, "refcounted_frames", 1, 0);
     
+    // decoder threads (ThreadCount, ThreadType in ini file)
+    dec_ctx->thread_count = gThreadCount;
+    if (gThreadType == 1) {
+        dec_ctx->thread_type = FF_THREAD_FRAME;
+    } else if (gThreadType == 2) {
+        dec_ctx->thread_type = FF_THREAD_SLICE;
+    } else {
+        dec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+    
     if ((ret = avcodec_open2(dec_ctx, dec, NULL)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot open video decoder\n");
-        avformat_close_input(&fmt_ctx);
+        video_stream_index = -1;  // (packets of video are dropped by demux thread)
+        dec_ctx = NULL;
         return ret;
     }
+    gDecodeSkipLevel = 0;  // (new decoder skips nothing)
     
     return 0;
 }
 
-int AudioStream_OpenFile(const wchar_t *filename)
+// open audio decoder of fmt_ctx (call after Stream_OpenInput)
+int AudioStream_OpenDecoder(void)
 {
     int ret;
     AVCodec *dec;
-    char filename_utf8[MAX_PATH * 2];
     
-    //CP932toUTF8(filename_utf8, sizeof(filename_utf8), filename);
-    WideCharToMultiByte(CP_UTF8, 0, filename, -1, filename_utf8, sizeof(filename_utf8), NULL, NULL);
-    
-    afmt_ctx = NULL;
+    audio_stream_index = -1;
     adec_ctx = NULL;
     
-    //if ((ret = avformat_open_input(&afmt_ctx, filename, NULL, NULL)) < 0) {
-    if ((ret = avformat_open_input(&afmt_ctx, filename_utf8, NULL, NULL)) < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        return ret;
-    }
-    
-    if ((ret = avformat_find_stream_info(afmt_ctx, NULL)) < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&afmt_ctx);
-        return ret;
-    }
-    
-    if ((ret = av_find_best_stream(afmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &dec, 0)) < 0) {
+    if ((ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &dec, 0)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot find a audio stream in the input file\n");
-        avformat_close_input(&afmt_ctx);
         return ret;
     }
     audio_stream_index = ret;
-    adec_ctx = afmt_ctx->streams[audio_stream_index]->codec;
+    adec_ctx = fmt_ctx->streams[audio_stream_index]->codec;
     av_opt_set_int(adec_ctx, "refcounted_frames", 1, 0);
     
     if ((ret = avcodec_open2(adec_ctx, dec, NULL)) < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot open audio decoder\n");
-        avformat_close_input(&afmt_ctx);
+        audio_stream_index = -1;  // (packets of audio are dropped by demux thread)
+        adec_ctx = NULL;
         return ret;
     }
     
@@ -519,28 +637,108 @@ int Stream_OpenFile(const wchar_t *filename)
 {
     if (video_stream_index != -1) {
         avcodec_close(dec_ctx);
-        avformat_close_input(&fmt_ctx);
         video_stream_index = -1;
     }
     if (audio_stream_index != -1) {
         avcodec_close(adec_ctx);
-        avformat_close_input(&afmt_ctx);
         audio_stream_index = -1;
     }
+    avformat_close_input(&fmt_ctx);
     
     gReadDoneAudio = 0;
     gReadDoneVideo = 0;
     
-    if (AudioStream_OpenFile(filename) < 0) {
+    if (Stream_OpenInput(filename) < 0) {
+        gReadDoneAudio = 1;
+        gReadDoneVideo = 1;
+        return 0;
+    }
+    if (AudioStream_OpenDecoder() < 0) {
         gReadDoneAudio = 1;
     }
-    if (VideoStream_OpenFile(filename) < 0) {
+    if (VideoStream_OpenDecoder() < 0) {
         gReadDoneVideo = 1;
     }
     
     return 0;
 }
 
+// release callback of packet node (unref packet in slab)
+void Demux_ReleasePacket(Framebuffer *buf)
+{
+    av_packet_unref((AVPacket *)buf->data);
+    Framebuffer_MemoryReport(-buf->bytes);
+}
+
+// read next packet of audio or video stream into packet node (demux thread)
+// return NULL: packet of other stream or of ended decoder, end of file (gReadDoneDemux is set) or no memory
+Framebuffer *Demux_ReadPacket(void)
+{
+    AVPacket packet;
+    Framebuffer *pbuf;
+    int type;
+    
+    if (av_read_frame(fmt_ctx, &packet) < 0) {
+        gReadDoneDemux = 1;
+        return NULL;
+    }
+    
+    if ((packet.stream_index == video_stream_index) && (video_stream_index != -1) && !gReadDoneVideo) {
+        type = FRAMEBUFFER_TYPE_VPACKET;
+    } else if ((packet.stream_index == audio_stream_index) && (audio_stream_index != -1) && !gReadDoneAudio) {
+        type = FRAMEBUFFER_TYPE_APACKET;
+    } else {
+        av_packet_unref(&packet);
+        return NULL;
+    }
+    
+    pbuf = Framebuffer_NewFromPool(type, sizeof(AVPacket), 1);
+    if (pbuf) {
+        // (av_packet_ref copies data of packet which is not reference counted)
+        if (av_packet_ref((AVPacket *)pbuf->data, &packet) < 0) {
+            Framebuffer_Free(pbuf);
+            pbuf = NULL;
+        } else {
+            pbuf->bytes = packet.size;
+            pbuf->release = Demux_ReleasePacket;
+            Framebuffer_MemoryReport(pbuf->bytes);
+        }
+    }
+    av_packet_unref(&packet);
+    
+    return pbuf;
+}
+
+// drop packets of stream whose decoder has ended, so that other stream is not blocked (demux thread)
+// (queue is only flushed here. skipped nodes are freed at Demux_Flush of next seek or restart)
+void Demux_DropDone(void)
+{
+    if (gDemuxPending) {
+        if (((gDemuxPending->type == FRAMEBUFFER_TYPE_VPACKET) && gReadDoneVideo) ||
+            ((gDemuxPending->type == FRAMEBUFFER_TYPE_APACKET) && gReadDoneAudio)) {
+            Framebuffer_Free(gDemuxPending);
+            gDemuxPending = NULL;
+        }
+    }
+    if (gReadDoneVideo && Framebuffer_ListNum(FRAMEBUFFER_TYPE_VPACKET)) Framebuffer_Flush(FRAMEBUFFER_TYPE_VPACKET);
+    if (gReadDoneAudio && Framebuffer_ListNum(FRAMEBUFFER_TYPE_APACKET)) Framebuffer_Flush(FRAMEBUFFER_TYPE_APACKET);
+}
+
+// drop queued and pending packets, and partial audio packet (main thread. lock gMutexDemux and gMutexVideo)
+void Demux_Flush(void)
+{
+    if (gDemuxPending) Framebuffer_Free(gDemuxPending);
+    gDemuxPending = NULL;
+    Clear_Cuedata(FRAMEBUFFER_TYPE_APACKET);
+    Clear_Cuedata(FRAMEBUFFER_TYPE_VPACKET);
+    
+    av_packet_unref(&apacket0);
+    apacket0.data = NULL;
+    apacket.data = NULL;
+    
+    gReadDoneDemux = 0;
+}
+
 int VideoStream_InitFilters(const char *filters_descr)
 {
     char args[512];
@@ -619,7 +817,7 @@ int AudioStream_InitFilters(const char *filters_descr)
     static const int64_t out_channel_layouts[] = { AV_CH_LAYOUT_STEREO, -1 };
     int out_sample_rates[] = { gSampleRate, -1 };
     const AVFilterLink *outlink;
-    AVRational time_base = afmt_ctx->streams[audio_stream_index]->time_base;
+    AVRational time_base = fmt_ctx->streams[audio_stream_index]->time_base;
     
     avfilter_graph_free(&afilter_graph);
     afilter_graph = avfilter_graph_alloc();
@@ -704,7 +902,6 @@ void Stream_Seek(int64_t delta)
 {
     int64_t current_ts, seek_min, seek_target, seek_max;
     int     flags;
-    Framebuffer *buf;
 
     flags = 0;
     
@@ -715,28 +912,25 @@ void Stream_Seek(int64_t delta)
     seek_max    = (delta < 0) ? current_ts - 100 : INT64_MAX;
     flags       = 0;  // AVSEEK_FLAG_ANY;
     
+    // one seek of shared context. packets and frames of old position are dropped on both streams
+    MUTEX_LOCK(gMutexDemux);
+    MUTEX_LOCK(gMutexVideo);
+    if (fmt_ctx) {
+        //avformat_seek_file(fmt_ctx, video_stream_index, seek_min, seek_target, seek_max, flags);
+        avformat_seek_file(fmt_ctx, -1, seek_min, seek_target, seek_max, flags);
+        Demux_Flush();
+    }
     if (audio_stream_index != -1) {
-        SDL_PauseAudio(1);
-        //avformat_seek_file(afmt_ctx, audio_stream_index, seek_min, seek_target, seek_max, flags);
-        avformat_seek_file(afmt_ctx, -1, seek_min, seek_target, seek_max, flags);
-        SDL_LockAudio();
-        while(Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIO)) {
-            buf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIO);
-            Framebuffer_Free(buf);
-        }
-        SDL_UnlockAudio();
-        SDL_PauseAudio(0);
+        Clear_Cuedata(FRAMEBUFFER_TYPE_AUDIO);  // no lock. SDL callback discards old data
     }
     if (video_stream_index != -1) {
-        //avformat_seek_file(fmt_ctx, video_stream_index, seek_min, seek_target, seek_max, flags);
-        avformat_seek_file(fmt_ctx, -1, seek_min, seek_target, seek_max, flags);
-        while(Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO)) {
-            buf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
-            TextScreen_FreeBitmap((TextScreenBitmap *)buf->data);
-            Framebuffer_Free(buf);
-        }
+        Clear_Cuedata(FRAMEBUFFER_TYPE_VIDEO);
     }
+    gSeekedVideo = 1;
+    MUTEX_UNLOCK(gMutexVideo);
+    MUTEX_UNLOCK(gMutexDemux);
     gStartTime = gStartTime - delta;
+    gVDiff = 0;  // (lateness of old position)
     gSeeked = 1;
 }
 
@@ -792,8 +986,8 @@ static void AudioStream_SDLCallback(void *userdata, uint8_t *stream, int len)
     //gCallDiff = GetTickCount() - gCallPrevTime; // for test
     //gCallPrevTime = GetTickCount();             // for test
     
-    stream16buf = (int16_t *)malloc(sizeof(int16_t) * len / 2);
-    if (!stream16buf) return;
+    // write directly to SDL buffer (no allocation in audio thread)
+    stream16buf = (int16_t *)stream;
     
     stream16len = len / 2;
     count = 0;
@@ -822,8 +1016,15 @@ static void AudioStream_SDLCallback(void *userdata, uint8_t *stream, int len)
                 pos += 2;
             }
             if (pos >= abuf->size) {
-                abuf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIO);
-                Framebuffer_Free(abuf);
+                Framebuffer *gbuf;
+                
+                // used node is freed by main thread (av_frame_free must not run in audio thread)
+                gbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIO);
+                if (gbuf == abuf) {
+                    Framebuffer_Return(gbuf);
+                } else if (gbuf) {  // flushed while playing abuf (abuf is skipped by Get)
+                    if (Framebuffer_Sendback(gbuf)) Framebuffer_Return(gbuf);
+                }
                 abuf = NULL;
             }
         } else {
@@ -832,6 +1033,9 @@ static void AudioStream_SDLCallback(void *userdata, uint8_t *stream, int len)
                 gAudioCurrentPlaynum = Playlist_GetCurrentPlay();
             }
             
+            if (!gPause && !gReadDoneAudio && (audio_stream_index != -1)) {
+                Framebuffer_CountUnderrun(FRAMEBUFFER_TYPE_AUDIO);
+            }
             while (count < stream16len) {
                 *(stream16buf + count) = 0;
                 count++;
@@ -846,11 +1050,9 @@ static void AudioStream_SDLCallback(void *userdata, uint8_t *stream, int len)
     AudioStream_VolumeAdjust(stream16buf, stream16len);  // volume adjust
     
     // copy audio data to buffer for draw wave
-    abuf = Framebuffer_New(stream16len * 2, 0);
+    abuf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_AUDIOWAVE, stream16len * 2, 0);
     if (abuf) {
-        data = (int16_t *)abuf->data;
         abuf->pts =gAudioCurrentPts;
-        abuf->type = FRAMEBUFFER_TYPE_AUDIOWAVE;
         abuf->playnum = gAudioCurrentPlaynum;
         memcpy(abuf->data, stream16buf, len);
         if (Framebuffer_Put(abuf)) {
@@ -858,9 +1060,6 @@ static void AudioStream_SDLCallback(void *userdata, uint8_t *stream, int len)
         }
     }
     
-    memcpy(stream, stream16buf, len);
-    free(stream16buf);
-    
     //gCallDiff = GetTickCount() - gCallPrevTime; // for test
 }
 
@@ -874,14 +1073,22 @@ static void exit_proc(void)
     SDL_Quit();
     
     // Thread destroy
+    pthread_join(gVideoTid , NULL );
+    MUTEX_DESTROY(gMutexVideo);
+    pthread_join(gDemuxTid , NULL );
+    MUTEX_DESTROY(gMutexDemux);
     pthread_join(gAudioWaveTid , NULL );
     MUTEX_DESTROY(gMutexBitmapWave);
+    pthread_join(gPresentTid , NULL );
+    MUTEX_DESTROY(gMutexScreen);
     
     // free all cue data
+    Demux_Flush();
     Clear_Cuedata(FRAMEBUFFER_TYPE_AUDIO);
     Clear_Cuedata(FRAMEBUFFER_TYPE_VIDEO);
     Clear_Cuedata(FRAMEBUFFER_TYPE_VOID);
     Clear_Cuedata(FRAMEBUFFER_TYPE_AUDIOWAVE);
+    Clear_Cuedata(FRAMEBUFFER_TYPE_PRESENT);
     
     Framebuffer_Uninit();
     
@@ -893,20 +1100,21 @@ static void exit_proc(void)
     if (gBitmapClip) TextScreen_FreeBitmap(gBitmapClip);
     if (gBitmapList) TextScreen_FreeBitmap(gBitmapList);
     if (gBitmapLastVideo) TextScreen_FreeBitmap(gBitmapLastVideo);
+    TextScreen_FlushBitmapPool();
     
     // free audio, video context
     avfilter_graph_free(&filter_graph);
     avcodec_close(dec_ctx);
-    avformat_close_input(&fmt_ctx);
     av_frame_free(&frame);
     av_frame_free(&filter_frame);
     
     avfilter_graph_free(&afilter_graph);
     avcodec_close(adec_ctx);
-    avformat_close_input(&afmt_ctx);
     av_frame_free(&aframe);
     av_frame_free(&afilter_frame);
     
+    avformat_close_input(&fmt_ctx);
+    
     SetThreadExecutionState(ES_CONTINUOUS);
     
     // TEST: end timer resolution
@@ -937,6 +1145,17 @@ static BOOL MyConsoleCtrlHandler(DWORD ctrltype)
     return TRUE;
 }
 
+// release callback of audio node (unref decoded frame)
+// called in main thread only (SDL callback gives used nodes back by Framebuffer_Return)
+void AudioStream_ReleaseFrame(Framebuffer *buf)
+{
+    AVFrame *ref;
+    
+    ref = (AVFrame *)buf->opaque;
+    av_frame_free(&ref);
+    Framebuffer_MemoryReport(-buf->size);
+}
+
 int AudioStream_ReadAndBuffer(void)
 {
     //AVPacket apacket;
@@ -961,15 +1180,21 @@ int AudioStream_ReadAndBuffer(void)
         }
     }
     
-    if (isFramebuffer_Full(FRAMEBUFFER_TYPE_AUDIO)) return 0;
+    if (isCuedata_Full(FRAMEBUFFER_TYPE_AUDIO)) return 0;
     
     if (!apacket0.data) {
-        if ((ret = av_read_frame(afmt_ctx, &apacket)) < 0) {
-            return -1;
-        } else {
-            apacket0 = apacket;
-            ptsoffset = 0;
+        Framebuffer *pbuf;
+        int done;
+        
+        done = gReadDoneDemux;  // (read before Get. demux thread sets it after last packet)
+        pbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_APACKET);
+        if (!pbuf) {
+            return done ? -1 : 0;
         }
+        av_packet_move_ref(&apacket, (AVPacket *)pbuf->data);
+        Framebuffer_Free(pbuf);
+        apacket0 = apacket;
+        ptsoffset = 0;
     }
     
     if (apacket.stream_index == audio_stream_index) {
@@ -1026,7 +1251,7 @@ int AudioStream_ReadAndBuffer(void)
             
             afilter_frame->pts = av_frame_get_best_effort_timestamp(afilter_frame);
             // time_base = abuffersink_ctx->inputs[0]->time_base;
-            time_base = afmt_ctx->streams[audio_stream_index]->time_base;
+            time_base = fmt_ctx->streams[audio_stream_index]->time_base;
             pts_time = av_rescale_q(afilter_frame->pts, time_base, AV_TIME_BASE_Q) + ptsoffset;
             
             //samples = afilter_frame->nb_samples * 
@@ -1078,13 +1303,31 @@ int AudioStream_ReadAndBuffer(void)
                     }
                     
                     if (samples) {
-                        abuf = Framebuffer_New(samples * 2, 0);
-                        if (abuf) {
+                        AVFrame *ref;
+                        
+                        // node refers decoded frame (s16 stereo packed) directly. copy only if failed
+                        ref = av_frame_clone(afilter_frame);
+                        abuf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_AUDIO, ref ? 0 : samples * 2, 0);
+                        if (abuf && ref) {
+                            abuf->data    = (void *)ref->data[0];
+                            abuf->size    = samples * 2;
+                            abuf->bytes   = samples * 2;
+                            abuf->opaque  = (void *)ref;
+                            abuf->release = AudioStream_ReleaseFrame;
+                            Framebuffer_MemoryReport(abuf->size);
+                            ref = NULL;
+                            abuf->pts = pts_time;
+                            abuf->duration = (int64_t)(samples / 2) * 1000000L / (int64_t)gSampleRate;
+                            abuf->playnum = Playlist_GetCurrentPlay();
+                            
+                            if (Framebuffer_Put(abuf)) {
+                                Framebuffer_Free(abuf);
+                            }
+                        } else if (abuf) {
                             
                             data = (int16_t *)abuf->data;
                             abuf->pts = pts_time;
-                            abuf->type = FRAMEBUFFER_TYPE_AUDIO;
-                            abuf->flags = 0;
+                            abuf->duration = (int64_t)(samples / 2) * 1000000L / (int64_t)gSampleRate;
                             abuf->playnum = Playlist_GetCurrentPlay();
                             for (i = 0; i < samples; i++) {
                                 data[i] = *p;
@@ -1096,10 +1339,11 @@ int AudioStream_ReadAndBuffer(void)
                                 p++;
                             }
                             
-                            SDL_LockAudio();
-                            Framebuffer_Put(abuf);
-                            SDL_UnlockAudio();
+                            if (Framebuffer_Put(abuf)) {
+                                Framebuffer_Free(abuf);
+                            }
                         }
+                        if (ref) av_frame_free(&ref);
                     }
                 }
             }
@@ -1128,12 +1372,74 @@ int AudioStream_ReadAndBuffer(void)
     return 0;
 }
 
+// frame pacing: return 1 if frame at pts should be skipped (console can not show it in time)
+// duration: frame duration of source (usec)
+int VideoStream_PaceSkip(int64_t pts, int64_t duration)
+{
+    static int64_t lastpts = 0;
+    int64_t interval;
+    
+    interval = gFramePacing ? gPaceInterval : 0;
+    // keep evenly spaced frames (60fps source to 12fps console: every 5th frame)
+    if ((interval > duration) && (pts >= lastpts) && (pts - lastpts < interval - duration / 2)) return 1;
+    lastpts = pts;  // (also reset by seek)
+    return 0;
+}
+
+// adapt skip_frame, skip_loop_filter and skip_idct of video decoder to lateness of video (gVDiff)
+// raise level when more than 2/4/8 frames late, relax after 1 sec when less than 1/2/4 frames late
+// duration: frame duration of source (usec)
+void VideoStream_SkipControl(int64_t duration)
+{
+    // deblocking and non-reference frames are not visible on 80-300 columns
+    static const enum AVDiscard skipframe[DECODE_SKIP_LEVELS] =
+                    { AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_NONKEY };
+    static const enum AVDiscard skiploopfilter[DECODE_SKIP_LEVELS] =
+                    { AVDISCARD_DEFAULT, AVDISCARD_ALL,     AVDISCARD_ALL,    AVDISCARD_ALL };
+    static const enum AVDiscard skipidct[DECODE_SKIP_LEVELS] =
+                    { AVDISCARD_DEFAULT, AVDISCARD_NONREF,  AVDISCARD_NONREF, AVDISCARD_NONREF };
+    static DWORD changetime = 0;
+    DWORD   curtime;
+    int64_t vdiff;
+    int     level;
+    
+    vdiff = gVDiff;
+    if ((vdiff < 0) || (vdiff >= 1000LL*1000LL*1000LL)) vdiff = 0;  // (frames ignored after seek have pts -1000sec)
+    
+    curtime = GetTickCount();
+    level = gDecodeSkipLevel;
+    if (!gDecodeSkip || gDebugDecode) {
+        level = 0;
+    } else if ((level < DECODE_SKIP_LEVELS - 1) && (vdiff > duration * (2 << level))) {
+        // wait until frames decoded with last level reach main loop (through video queue)
+        if (curtime - changetime >= 500) level++;
+    } else if ((level > 0) && (vdiff < duration * (1 << (level - 1)))) {
+        if (curtime - changetime >= 1000) level--;
+    }
+    
+    if (level != gDecodeSkipLevel) {
+        dec_ctx->skip_frame       = skipframe[level];
+        dec_ctx->skip_loop_filter = skiploopfilter[level];
+        dec_ctx->skip_idct        = skipidct[level];
+        gDecodeSkipLevel = level;
+        changetime = curtime;
+    }
+}
+
+// release callback of video node (free bitmap)
+void VideoStream_ReleaseBitmap(Framebuffer *buf)
+{
+    if (buf->data) TextScreen_ReleaseBitmap((TextScreenBitmap *)buf->data);
+}
+
 int VideoStream_ReadAndBuffer(void)
 {
     AVPacket packet;
+    Framebuffer *pbuf;
     AVRational time_base;
     int ret;
     int got_frame;
+    int done, draining;
     int64_t pts_time;
     static int64_t prev_pts_time = 0;
     static int ignore_video = 0;
@@ -1141,16 +1447,41 @@ int VideoStream_ReadAndBuffer(void)
     
     ret = 0;
     
-    if (gSeeked) {
+    if (gSeekedVideo) {
         ignore_video = 8;
+        gSeekedVideo = 0;
+    }
+    
+    if (isCuedata_Full(FRAMEBUFFER_TYPE_VIDEO)) return 0;
+    
+    done = gReadDoneDemux;  // (read before Get. demux thread sets it after last packet)
+    draining = 0;
+    pbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_VPACKET);
+    if (pbuf) {
+        av_packet_move_ref(&packet, (AVPacket *)pbuf->data);
+        Framebuffer_Free(pbuf);
+    } else if (done) {
+        draining = 1;
+        // end of file: get frames delayed by decoder (frame threads) with empty packet
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        packet.stream_index = video_stream_index;
+    } else {
+        return 0;
     }
     
-    if (isFramebuffer_Full(FRAMEBUFFER_TYPE_VIDEO)) return 0;
-    
-    if ((ret = av_read_frame(fmt_ctx, &packet)) < 0) return -1;
     if (packet.stream_index == video_stream_index) {
+        if (!draining) {
+            AVRational frame_rate = fmt_ctx->streams[video_stream_index]->avg_frame_rate;
+            
+            VideoStream_SkipControl((frame_rate.num && frame_rate.den) ?
+                                    (int64_t)frame_rate.den * 1000000L / frame_rate.num : 40000);
+        }
         got_frame = 0;
-        decodecount = 64;
+        // (do not decode packet again with frame threads (next thread takes it as new frame) or skipping)
+        decodecount = ((dec_ctx->active_thread_type & FF_THREAD_FRAME) ||
+                       (dec_ctx->skip_frame != AVDISCARD_DEFAULT)) ? 1 : 64;
         
         while(!got_frame && decodecount--) {  // experimental 20150321 for PNG decode
             ret = avcodec_decode_video2(dec_ctx, frame, &got_frame, &packet);
@@ -1158,7 +1489,7 @@ int VideoStream_ReadAndBuffer(void)
                 av_log(NULL, AV_LOG_ERROR, "Error decoding video\n");
                 // av_free_packet(&packet);
                 av_packet_unref(&packet);
-                if (ret == AVERROR_INVALIDDATA) {
+                if ((ret == AVERROR_INVALIDDATA) && !draining) {
                     return 0;
                 } else {
                     return -1;
@@ -1170,7 +1501,23 @@ int VideoStream_ReadAndBuffer(void)
             //av_free_packet(&packet);
             av_packet_unref(&packet);
             //printf("png! ret=%d", ret);
-            return 0;
+            return draining ? -1 : 0;  // (no more delayed frame)
+        }
+        
+        if (!ignore_video && !gDebugDecode) {  // skip filter and ASCII conversion of frames console can not show
+            AVRational frame_rate = fmt_ctx->streams[video_stream_index]->avg_frame_rate;
+            int64_t    duration;
+            
+            pts_time = av_rescale_q(av_frame_get_best_effort_timestamp(frame),
+                                    fmt_ctx->streams[video_stream_index]->time_base, AV_TIME_BASE_Q);
+            duration = (frame_rate.num && frame_rate.den) ?
+                        (int64_t)frame_rate.den * 1000000L / frame_rate.num : 40000;
+            if ((av_frame_get_best_effort_timestamp(frame) != AV_NOPTS_VALUE) &&
+                VideoStream_PaceSkip(pts_time, duration)) {
+                av_frame_unref(frame);
+                av_packet_unref(&packet);
+                return 0;
+            }
         }
         
         if (av_buffersrc_add_frame_flags(buffersrc_ctx, frame, AV_BUFFERSRC_FLAG_KEEP_REF) < 0) {
@@ -1179,8 +1526,6 @@ int VideoStream_ReadAndBuffer(void)
         }
         
         while (1) {
-            uint8_t *p0, *p;
-            int x, y;
             TextScreenBitmap *tmp;
             Framebuffer *vbuf;
             
@@ -1206,7 +1551,8 @@ int VideoStream_ReadAndBuffer(void)
             if (filter_frame->pts == AV_NOPTS_VALUE) pts_time = 0;
             
             if (pts_time < prev_pts_time) {
-                Clear_Cuedata(FRAMEBUFFER_TYPE_VIDEO);
+                // (video decode thread is producer only. main thread skips flushed frames at next Get)
+                Framebuffer_Flush(FRAMEBUFFER_TYPE_VIDEO);
             }
             prev_pts_time = pts_time;
             
@@ -1228,21 +1574,26 @@ int VideoStream_ReadAndBuffer(void)
                         ignore_video--;
                     }
                     
-                    p0 = filter_frame->data[0];
-                    for (y = 0; y < filter_frame->height; y++) {
-                        p = p0;
-                        for (x = 0; x < filter_frame->width; x++)
-                            TextScreen_PutCell(gBitmap, x, y, " .-:+*H#"[*(p++) / 32]);
-                        p0 += filter_frame->linesize[0];
-                    }
-                    tmp = TextScreen_DupBitmap(gBitmap);
-                    vbuf = Framebuffer_New(0, 0);
+                    // convert frame straight into queued bitmap
+                    tmp = TextScreen_AcquireBitmap(gBitmap->width, gBitmap->height);
+                    if (tmp) TextScreen_MapBitmap(tmp, filter_frame->data[0], filter_frame->linesize[0],
+                                                  filter_frame->width, filter_frame->height, gGlyphRamp.table);
+                    vbuf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_VIDEO, 0, 0);
                     if (vbuf) {
-                        vbuf->type = FRAMEBUFFER_TYPE_VIDEO;
+                        AVRational frame_rate = fmt_ctx->streams[video_stream_index]->avg_frame_rate;
+                        
                         vbuf->pts  = pts_time;
+                        vbuf->duration = (frame_rate.num && frame_rate.den) ?
+                                    (int64_t)frame_rate.den * 1000000L / frame_rate.num : 40000;
+                        vbuf->bytes = tmp ? tmp->width * tmp->height : 0;
                         vbuf->data = (void *)tmp;
+                        vbuf->release = VideoStream_ReleaseBitmap;
                         vbuf->playnum = Playlist_GetCurrentPlay();
-                        Framebuffer_Put(vbuf);
+                        if (Framebuffer_Put(vbuf)) {
+                            Framebuffer_Free(vbuf);
+                        }
+                    } else {
+                        TextScreen_ReleaseBitmap(tmp);
                     }
                 }
             }
@@ -1262,26 +1613,11 @@ void Do_Clipboard_Copy(int reverse) {
     SIZE_T  size;
     char *p;
     char cell;
-    int i, x, y, index;
-    char neg[256];
+    int x, y, index;
     
     bitmap = gBitmapClip;
     if (!bitmap) return;
     
-    // make negative table
-    for (i = 0; i < 256; i++) {
-        neg[i] = '.';
-    }
-    neg[(unsigned char)' '] = '#';
-    neg[(unsigned char)'.'] = 'M';
-    neg[(unsigned char)'-'] = 'H';
-    neg[(unsigned char)':'] = '*';
-    neg[(unsigned char)'+'] = '+';
-    neg[(unsigned char)'*'] = ':';
-    neg[(unsigned char)'H'] = '-';
-    neg[(unsigned char)'#'] = '.';
-    
-    
     if (OpenClipboard( GetConsoleWindow() )) {
         size = (bitmap->width + 2) * bitmap->height + 2;
         cdata = GlobalAlloc(GMEM_MOVEABLE, size);
@@ -1294,7 +1630,7 @@ void Do_Clipboard_Copy(int reverse) {
                     if (!reverse) {
                         p[index++] = cell;
                     } else {
-                        p[index++] = neg[(unsigned char)cell];
+                        p[index++] = gGlyphRamp.negative[(unsigned char)cell];
                     }
                 }
                 p[index++] = 0x0d;
@@ -1319,29 +1655,27 @@ void Stream_Restart(const wchar_t *filename, int seamless)
     }
     snwprintf(gFilename, MAX_PATH, L"%s", filename);
     
+    MUTEX_LOCK(gMutexDemux);  // (stop demux thread)
+    MUTEX_LOCK(gMutexVideo);  // (stop video decode thread)
     { // close current stream
         int ret;
         char strbuf[256];
         
         if (video_stream_index != -1) {
             avcodec_close(dec_ctx);
-            avformat_close_input(&fmt_ctx);
             dec_ctx = NULL;
-            fmt_ctx = NULL;
             video_stream_index = -1;
         }
         if (audio_stream_index != -1) {
             avcodec_close(adec_ctx);
-            avformat_close_input(&afmt_ctx);
             adec_ctx = NULL;
-            afmt_ctx = NULL;
             audio_stream_index = -1;
         }
+        Demux_Flush();
+        avformat_close_input(&fmt_ctx);
         
         if (!seamless) {
-            SDL_LockAudio();
             Clear_Cuedata(FRAMEBUFFER_TYPE_AUDIO);
-            SDL_UnlockAudio();
         }
         Clear_Cuedata(FRAMEBUFFER_TYPE_VIDEO);
         Clear_Cuedata(FRAMEBUFFER_TYPE_VOID);
@@ -1351,33 +1685,45 @@ void Stream_Restart(const wchar_t *filename, int seamless)
         
         gReadDoneAudio = 0;
         gReadDoneVideo = 0;
-        // initialize audio stream (open file, init filters)
+        // open file once (packets of both streams are read by demux thread)
+        if (Stream_OpenInput(gFilename) < 0) {
+            gReadDoneAudio = 1;
+            gReadDoneVideo = 1;
+        }
+        
+        // initialize audio stream (open decoder, init filters)
         //snprintf(strbuf, sizeof(strbuf), "aresample=%d,aformat=sample_fmts=s16:channel_layouts=stereo", (int)gSampleRate);
         snprintf(strbuf, sizeof(strbuf), "anull");
-        if ((ret = AudioStream_OpenFile(gFilename)) < 0) {
+        if (gReadDoneAudio || ((ret = AudioStream_OpenDecoder()) < 0)) {
             gReadDoneAudio = 1;
         } else {
-            if ((ret = AudioStream_InitFilters(strbuf)) < 0 )
+            if ((ret = AudioStream_InitFilters(strbuf)) < 0 ) {
+                MUTEX_UNLOCK(gMutexVideo);
+                MUTEX_UNLOCK(gMutexDemux);
                 exit_proc();
+            }
         }
         
-        // initialize video stream (open file, init filters)
+        // initialize video stream (open decoder, init filters)
         snprintf(strbuf, sizeof(strbuf), "scale=%d:%d", gBitmap->width, gBitmap->height);
-        if ((ret = VideoStream_OpenFile(gFilename)) < 0) {
+        if (gReadDoneVideo || ((ret = VideoStream_OpenDecoder()) < 0)) {
             gReadDoneVideo = 1;
         } else {
-            if ((ret = VideoStream_InitFilters(strbuf)) < 0 )
+            if ((ret = VideoStream_InitFilters(strbuf)) < 0 ) {
+                MUTEX_UNLOCK(gMutexVideo);
+                MUTEX_UNLOCK(gMutexDemux);
                 exit_proc();
-            if (VideoStream_ReadAndBuffer() < 0) {
-                gReadDoneVideo = 1;
             }
         }
     }
+    MUTEX_UNLOCK(gMutexVideo);
+    MUTEX_UNLOCK(gMutexDemux);
     
     if (!seamless) {
         SDL_PauseAudio(0);
     }
     gStartTime = (int64_t)GetTickCount() * 1000;
+    gVDiff = 0;  // (lateness of previous file)
 }
 
 int Get_ConsoleSize(int *width, int *height)
@@ -1510,6 +1856,7 @@ void CheckOptionFilename(const wchar_t *fullpath_w)
     
     if (!strcmp(filename, TEXTMOVIE_TEXTMOVIE_INITFILE_NAME)) { // read .ini file
         ReadInitFile(fullpath);
+        Set_BufferLimit();
     }
     if (!strcmp(filename, "SHUFFLE")) {  // shuffle mode
         gOptionShuffle = 1;
@@ -1601,7 +1948,9 @@ int Playlist_Make(wchar_t *dirname, int count)
                         TextScreen_DrawText(gBitmap, 0, 0, "Search valid media files in a folder. Wait a moment please.");
                         snprintf(strbuf, sizeof(strbuf), "  %d files found.", count);
                         TextScreen_DrawText(gBitmap, 0, 1, strbuf);
+                        MUTEX_LOCK(gMutexScreen);
                         TextScreen_ShowBitmap(gBitmap, 0, 0);
+                        MUTEX_UNLOCK(gMutexScreen);
                         TextScreen_ClearBitmap(gBitmapList);
                     }
                 } else
@@ -1623,7 +1972,9 @@ int Playlist_Make(wchar_t *dirname, int count)
                         TextScreen_DrawText(gBitmap, 0, 0, "Search valid media files in a folder. Wait a moment please.");
                         snprintf(strbuf, sizeof(strbuf), "  %d files found.", count);
                         TextScreen_DrawText(gBitmap, 0, 1, strbuf);
+                        MUTEX_LOCK(gMutexScreen);
                         TextScreen_ShowBitmap(gBitmap, 0, 0);
+                        MUTEX_UNLOCK(gMutexScreen);
                         TextScreen_ClearBitmap(gBitmapList);
                     }
                     */
@@ -1778,7 +2129,9 @@ void Do_PlayPrevious(void)
         if (gShowPlaylist ) { // for key repeat: experimental 20150303
             TextScreen_ClearBitmap(gBitmap);
             Do_DrawPlaylist(gBitmap);
+            MUTEX_LOCK(gMutexScreen);
             TextScreen_ShowBitmap(gBitmap, 0, 0);
+            MUTEX_UNLOCK(gMutexScreen);
             if (gBitmapList) TextScreen_FreeBitmap(gBitmapList);
             gBitmapList = TextScreen_DupBitmap(gBitmap);
         }
@@ -1797,7 +2150,9 @@ void Do_PlayNext(void)
         if (gShowPlaylist ) { // for key repeat: experimental 20150303
             TextScreen_ClearBitmap(gBitmap);
             Do_DrawPlaylist(gBitmap);
+            MUTEX_LOCK(gMutexScreen);
             TextScreen_ShowBitmap(gBitmap, 0, 0);
+            MUTEX_UNLOCK(gMutexScreen);
             if (gBitmapList) TextScreen_FreeBitmap(gBitmapList);
             gBitmapList = TextScreen_DupBitmap(gBitmap);
         }
@@ -2052,9 +2407,7 @@ void Do_Keyboard_Check(void)
         if (ch == 'G') {
             gDebugDecode = !gDebugDecode;
             if (gDebugDecode) {
-                SDL_LockAudio();
                 Clear_Cuedata(FRAMEBUFFER_TYPE_AUDIO);
-                SDL_UnlockAudio();
                 Clear_Cuedata(FRAMEBUFFER_TYPE_VIDEO);
                 Clear_Cuedata(FRAMEBUFFER_TYPE_VOID);
                 Clear_Cuedata(FRAMEBUFFER_TYPE_AUDIOWAVE);
@@ -2117,9 +2470,13 @@ void Do_Resize_Check(void)
         if (screen.width < 1) screen.width = 1;
         if (screen.height < 1) screen.height = 1;
         
+        MUTEX_LOCK(gMutexScreen);
         TextScreen_Init(&screen);
         TextScreen_ClearScreen();
+        MUTEX_UNLOCK(gMutexScreen);
+        TextScreen_FlushBitmapPool();  // pooled bitmaps are old size
         
+        MUTEX_LOCK(gMutexVideo);  // (video decode thread uses size of gBitmap and video queue)
         TextScreen_FreeBitmap(gBitmap);
         gBitmap = TextScreen_CreateBitmap(screen.width, screen.height);
         
@@ -2145,7 +2502,7 @@ void Do_Resize_Check(void)
         for (i = 0; i < listnum; i++) {
             buf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
             bitmap = (TextScreenBitmap *)buf->data;
-            newbitmap = TextScreen_CreateBitmap(screen.width, screen.height);
+            newbitmap = TextScreen_AcquireBitmap(screen.width, screen.height);
             TextScreen_CopyBitmap(newbitmap, bitmap, 0, 0);
             TextScreen_FreeBitmap(bitmap);
             buf->data = (void *)newbitmap;
@@ -2153,9 +2510,12 @@ void Do_Resize_Check(void)
         }
         if (video_stream_index != -1) {
             snprintf(strbuf, sizeof(strbuf), "scale=%d:%d", gBitmap->width, gBitmap->height);
-            if (VideoStream_InitFilters(strbuf) < 0 )
-                    exit_proc();
+            if (VideoStream_InitFilters(strbuf) < 0 ) {
+                MUTEX_UNLOCK(gMutexVideo);
+                exit_proc();
+            }
         }
+        MUTEX_UNLOCK(gMutexVideo);
     }
 }
 
@@ -2215,7 +2575,7 @@ void Do_DrawInfo(TextScreenBitmap *bitmap)
     /*
     if (audio_stream_index != -1) {
         audio_codec_id = adec_ctx->codec_id;
-        duration = afmt_ctx->duration;
+        duration = fmt_ctx->duration;
     }
     if (video_stream_index != -1) {
         video_codec_id = dec_ctx->codec_id;
@@ -2256,11 +2616,36 @@ void Do_DrawInfo(TextScreenBitmap *bitmap)
             snprintf(strbuf, sizeof(strbuf), "FPS(ave): n/a ");
             TextScreen_DrawText(bitmap, 0, y++, strbuf);
         }
+        snprintf(strbuf, sizeof(strbuf), "Decoder Threads: %d (%s)  Skip: %d%s ", dec_ctx->thread_count,
+                        (dec_ctx->active_thread_type & FF_THREAD_FRAME) ? "frame" :
+                        (dec_ctx->active_thread_type & FF_THREAD_SLICE) ? "slice" : "none",
+                        gDecodeSkipLevel, gDecodeSkip ? "" : " (off)");
+        TextScreen_DrawText(bitmap, 0, y++, strbuf);
+    }
+    {
+        FramebufferStats astats, vstats;
+        
+        Framebuffer_GetStats(FRAMEBUFFER_TYPE_AUDIO, &astats);
+        Framebuffer_GetStats(FRAMEBUFFER_TYPE_VIDEO, &vstats);
+        snprintf(strbuf, sizeof(strbuf), "Audio Buffer: %2d (%4dms) hw:%d lw:%d underrun:%d wait:%dms ",
+                        astats.num, (int)(astats.duration / 1000), astats.highwater, astats.lowwater,
+                        (int)astats.underruns, (int)(astats.waittime / 1000));
+        TextScreen_DrawText(bitmap, 0, y++, strbuf);
+        snprintf(strbuf, sizeof(strbuf), "Video Buffer: %2d (%4dms) hw:%d lw:%d reject:%d ",
+                        vstats.num, (int)(vstats.duration / 1000), vstats.highwater, vstats.lowwater,
+                        (int)vstats.rejects);
+        TextScreen_DrawText(bitmap, 0, y++, strbuf);
+        snprintf(strbuf, sizeof(strbuf), "Media Memory: %dKB (budget:%dMB) ",
+                        (int)(Framebuffer_MemoryUsage() / 1024), gMemoryBudget);
+        TextScreen_DrawText(bitmap, 0, y++, strbuf);
+        // max frame: output size console can write within frame duration of source
+        snprintf(strbuf, sizeof(strbuf), "Console Output: %dKB/s frame:%dB (max:%dB) interval:%dms%s ",
+                        gPaceBytesPerSec / 1024, gPaceFrameBytes,
+                        ppd->video_avg_frame_rate_num ? (int)((int64_t)gPaceBytesPerSec *
+                        ppd->video_avg_frame_rate_den / ppd->video_avg_frame_rate_num) : 0,
+                        gPaceInterval / 1000, gFramePacing ? "" : " (pacing off)");
+        TextScreen_DrawText(bitmap, 0, y++, strbuf);
     }
-    snprintf(strbuf, sizeof(strbuf), "Audio Buffer: %2d ", Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIO));
-    TextScreen_DrawText(bitmap, 0, y++, strbuf);
-    snprintf(strbuf, sizeof(strbuf), "Video Buffer: %2d ", Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO));
-    TextScreen_DrawText(bitmap, 0, y++, strbuf);
     snprintf(strbuf, sizeof(strbuf), "Player Version: %s(%d), Build: %s %s ", VER_FILEVERSION_STR, (int)TEXTMOVIE_TEXTMOVIE_VERSION, __DATE__, __TIME__);
     TextScreen_DrawText(bitmap, 0, y++, strbuf);
     snprintf(strbuf, sizeof(strbuf), "by Coffey (c)2015-2016 ");
@@ -2287,13 +2672,14 @@ void Do_DrawInfo(TextScreenBitmap *bitmap)
     */
 }
 
-void Do_DrawStatus(void)
+// make status line (time, volume, A/V difference and level meter) to status
+void Do_MakeStatus(char *status, int size)
 {
     int ad, vd;
     int64_t pts;
     int hour, min, sec, dec, sign;
     int i, level;
-    char strbuf[128], strbuf2[64];
+    char strbuf2[64];
     PlaylistData  *ppd;
     int64_t duration, start_time;
     
@@ -2346,17 +2732,206 @@ void Do_DrawStatus(void)
     hour = sec / 3600;
     min = (sec / 60) % 60;
     sec = sec % 60;
-    snprintf(strbuf, sizeof(strbuf),"  %c%02d:%02d:%02d.%03d  V:%3d%c D:% 4d/%3dms%c [%s]  ", 
+    snprintf(status, size,"  %c%02d:%02d:%02d.%03d  V:%3d%c D:% 4d/%3dms%c [%s]  ", 
             sign ? ' ' : '-', hour, min, sec, dec, gVolume, gAudioClip ? '@' : ' ',
             ad, vd, gFrameDrop ? '*': ' ', strbuf2);
-    strbuf[78]=0;
-    printf("%s", strbuf);
+    if (size > 78) status[78]=0;
     
     // gAudioLevel = gAudioLevel * 7 / 8;    // (to make level meter slow release)
     gAudioClip = (gAudioClip > 0) ? gAudioClip - 1 : 0;  // (decrement clip indicator count)
     gFrameDrop = 0;
 }
 
+// release callback of presenter node (release bitmap)
+void Present_ReleaseNode(Framebuffer *buf)
+{
+    if (buf->opaque) TextScreen_ReleaseBitmap((TextScreenBitmap *)buf->opaque);
+}
+
+// update sustainable frame interval from measured console throughput (presenter thread)
+// bytes: output size of frame  usec: time spent for writing it
+void Present_UpdatePace(int bytes, int usec)
+{
+    static int64_t sumbytes = 0, sumusec = 0;
+    int64_t interval;
+    
+    if (bytes <= 0) return;
+    // moving average of recent frames (weight of old frames decays 7/8 per frame)
+    sumbytes = sumbytes - sumbytes / 8 + bytes;
+    sumusec  = sumusec  - sumusec  / 8 + usec;
+    if (!sumusec) return;
+    gPaceBytesPerSec = (int)(sumbytes * 1000000 / sumusec);
+    gPaceFrameBytes  = (int)(sumbytes / 8);
+    
+    // time for writing average frame + 25% headroom
+    interval = sumusec / 8 * 5 / 4;
+    if (interval > 1000000) interval = 1000000;
+    // hysteresis: ignore small changes (pacing does not oscillate by measurement noise)
+    if ((interval > gPaceInterval + gPaceInterval / 8) || (interval < gPaceInterval - gPaceInterval / 8))
+        gPaceInterval = (int)interval;
+}
+
+// post frame and status line to presenter thread (latest one wins)
+// bitmap: frame (owned by presenter. NULL: status line only)  statusy: line of status
+void Present_Post(TextScreenBitmap *bitmap, int statusy)
+{
+    Framebuffer *pbuf;
+    char status[PRESENT_STATUS_SIZE];
+    
+    // make status every tick (it also updates counters of status line)
+    Do_MakeStatus(status, PRESENT_STATUS_SIZE);
+    
+    // status line only: skip if presenter has not written previous one yet
+    if (!bitmap && Framebuffer_ListNum(FRAMEBUFFER_TYPE_PRESENT)) return;
+    
+    pbuf = Framebuffer_NewFromPool(FRAMEBUFFER_TYPE_PRESENT, PRESENT_STATUS_SIZE, 0);
+    if (!pbuf) {
+        TextScreen_ReleaseBitmap(bitmap);
+        return;
+    }
+    memcpy(pbuf->data, status, PRESENT_STATUS_SIZE);
+    pbuf->opaque  = (void *)bitmap;
+    pbuf->release = Present_ReleaseNode;
+    pbuf->pos     = statusy;
+    
+    // console can not keep up: drop frames not written yet
+    if (isFramebuffer_Full(FRAMEBUFFER_TYPE_PRESENT)) Framebuffer_Flush(FRAMEBUFFER_TYPE_PRESENT);
+    if (Framebuffer_Put(pbuf)) Framebuffer_Free(pbuf);
+}
+
+// presenter thread: write frame and status line to console (main loop does not wait for console)
+void Present_Entry(void)
+{
+    while(!gQuitFlag) {
+        Framebuffer *pbuf, *nextbuf;
+        TextScreenBitmap *bitmap;
+        int bytes, usec;
+        
+        pbuf = Framebuffer_WaitGet(FRAMEBUFFER_TYPE_PRESENT, 100);
+        if (!pbuf) continue;
+        while ((nextbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_PRESENT))) {  // write latest one only
+            if (!nextbuf->opaque) {  // status line only: keep frame
+                nextbuf->opaque = pbuf->opaque;
+                pbuf->opaque = NULL;
+            }
+            Framebuffer_Free(pbuf);
+            pbuf = nextbuf;
+        }
+        
+        bitmap = (TextScreenBitmap *)pbuf->opaque;
+        MUTEX_LOCK(gMutexScreen);
+        TextScreen_GetOutputStats(NULL, NULL);  // (discard output of main thread)
+        TextScreen_BeginOutput();  // frame and status line are written at once
+        if (bitmap) TextScreen_ShowBitmap(bitmap, 0, 0);
+        TextScreen_SetCursorPos(0, pbuf->pos);
+        TextScreen_OutputText((char *)pbuf->data);
+        TextScreen_FlushOutput();
+        TextScreen_GetOutputStats(&bytes, &usec);
+        MUTEX_UNLOCK(gMutexScreen);
+        if (bitmap) Present_UpdatePace(bytes, usec);
+        Framebuffer_Free(pbuf);
+    }
+}
+
+// video decode thread: decode, scale and convert video to video queue (main loop does not wait for decoder)
+void VideoDecode_Entry(void)
+{
+    while(!gQuitFlag) {
+        int idle;
+        
+        idle = 1;
+        MUTEX_LOCK(gMutexVideo);
+        if ((video_stream_index != -1) && !gReadDoneVideo && !gPause && !isCuedata_Full(FRAMEBUFFER_TYPE_VIDEO) &&
+            (Framebuffer_ListNum(FRAMEBUFFER_TYPE_VPACKET) || gReadDoneDemux)) {
+            if (VideoStream_ReadAndBuffer() < 0) {
+                gReadDoneVideo = 1;
+            }
+            idle = 0;
+        }
+        MUTEX_UNLOCK(gMutexVideo);
+        
+        if (!idle) continue;
+        if (!gReadDoneVideo && !gPause && isFramebuffer_Full(FRAMEBUFFER_TYPE_VIDEO)) {
+            Framebuffer_WaitSpace(FRAMEBUFFER_TYPE_VIDEO, 10);  // wake up when main loop gets frame
+        } else if (!gReadDoneVideo && !gPause && !isFramebuffer_OverBudget()) {
+            Framebuffer_WaitData(FRAMEBUFFER_TYPE_VPACKET, 10);  // wake up when demux thread puts packet
+        } else {
+            Sleep(10);  // (paused, end of stream or over memory budget)
+        }
+    }
+}
+
+// demux thread: read packets of shared format context and route them to audio and video packet queues
+// (a packet waits in gDemuxPending while its queue is full. other queue is not filled meanwhile)
+void Demux_Entry(void)
+{
+    while(!gQuitFlag) {
+        int wait;
+        
+        wait = -1;
+        MUTEX_LOCK(gMutexDemux);
+        if (fmt_ctx && !gReadDoneDemux) {
+            Demux_DropDone();
+            if (!gDemuxPending) gDemuxPending = Demux_ReadPacket();
+            if (gDemuxPending) {
+                if (isFramebuffer_Full(gDemuxPending->type)) {
+                    wait = gDemuxPending->type;
+                } else {
+                    if (Framebuffer_Put(gDemuxPending)) {
+                        Framebuffer_Free(gDemuxPending);
+                    }
+                    gDemuxPending = NULL;
+                }
+            }
+        } else {
+            wait = FRAMEBUFFER_TYPE_VOID;
+        }
+        MUTEX_UNLOCK(gMutexDemux);
+        
+        if (wait == -1) continue;
+        if (wait != FRAMEBUFFER_TYPE_VOID) {
+            Framebuffer_WaitSpace(wait, 10);  // wake up when decoder gets packet
+        } else {
+            Sleep(10);  // (no file or end of file)
+        }
+    }
+}
+
+// append framebuffer statistics to log file every gStatsInterval sec (StatsLog in ini file)
+void Do_StatsLog(void)
+{
+    static DWORD prevtime = 0;
+    DWORD  curtime;
+    FILE   *fp;
+    
+    if (!gStatsLog[0]) return;
+    
+    curtime = GetTickCount();
+    if (!prevtime) prevtime = curtime;
+    if (curtime - prevtime < (DWORD)gStatsInterval * 1000) return;
+    prevtime = curtime;
+    
+    fp = fopen(gStatsLog, "a");
+    if (fp) {
+        fprintf(fp, "[%u]\n", (unsigned int)curtime);
+        Framebuffer_DumpStats(fp);
+        fprintf(fp, "console   throughput:%dKB/s frame:%dB interval:%dms\n",
+                gPaceBytesPerSec / 1024, gPaceFrameBytes, gPaceInterval / 1000);
+        fclose(fp);
+    }
+}
+
+// sleep max 'ms' millisecond. wake up early when audio buffer gets space (to read next audio)
+void Do_WaitBuffer(int ms)
+{
+    if (ms <= 0) return;
+    if (!gReadDoneAudio && (audio_stream_index != -1) && !isFramebuffer_OverBudget()) {
+        Framebuffer_WaitSpace(FRAMEBUFFER_TYPE_AUDIO, ms);
+    } else {
+        Sleep(ms);
+    }
+}
+
 void AudioWave_Entry(void)
 {
     TextScreenBitmap *waveBitmap = NULL;
@@ -2379,13 +2954,15 @@ void AudioWave_Entry(void)
             TextScreen_ClearBitmap(waveBitmap);
         }
         
-        while (Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIOWAVE) > 1) {
-            abuf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIOWAVE);
-            Framebuffer_Free(abuf);
-        }
-        
-        abuf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIOWAVE);
+        // sleep until audio callback sends wave data (timeout for quit check)
+        abuf = Framebuffer_WaitGet(FRAMEBUFFER_TYPE_AUDIOWAVE, 100);
         if (abuf) {
+            Framebuffer *nextbuf;
+            
+            while ((nextbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_AUDIOWAVE))) {  // draw latest one only
+                Framebuffer_Free(abuf);
+                abuf = nextbuf;
+            }
             stream16len = abuf->size / 2;
             stream16buf = (int16_t *)abuf->data;
             AudioWave_Draw(waveBitmap, stream16buf, stream16len);
@@ -2403,8 +2980,6 @@ void AudioWave_Entry(void)
             TextScreen_CopyBitmap(gBitmapWave, waveBitmap, 0, 0);
             MUTEX_UNLOCK(gMutexBitmapWave);
         }
-        
-        Sleep(10);
     }
     if (waveBitmap) TextScreen_FreeBitmap(waveBitmap);
 }
@@ -2456,11 +3031,14 @@ int main(int argc, char *argv[])
         }
     }
     
-    // init framebuffer
+    // init framebuffer (and count memory of bitmaps)
+    TextScreen_SetMemoryCallback(Framebuffer_MemoryReport);
     if (Framebuffer_Init()) {
         printf("Can not initialize framebuffer\n");
         exit(1);
     }
+    Set_BufferLimit();
+    Set_GlyphTable();
     
     // set terminate callback routine (for press ctrl+c, press close button of console window, user logout ...)
     SetConsoleCtrlHandler((PHANDLER_ROUTINE)MyConsoleCtrlHandler, TRUE);
@@ -2476,8 +3054,7 @@ int main(int argc, char *argv[])
     
     // Initialize TextScreen. (calculate text screen size from current console window size)
     TextScreen_GetSettingDefault(&screen);
-    screen.renderingMethod = TEXTSCREEN_RENDERING_METHOD_FAST;
-    // screen.renderingMethod = TEXTSCREEN_RENDERING_METHOD_WINCONSOLE;
+    screen.renderingMethod = gRenderingMethod;
     
     screen.width  = console_width - 4;   // console width  - 4
     screen.height = console_height - 3;  // console height - 3
@@ -2521,6 +3098,19 @@ int main(int argc, char *argv[])
         exit(1);
     }
     
+    // framebuffer node pool (audio: node only, wave: 1x callback size)
+    // number of audio nodes: buffer time / typical decoded frame (1024 samples)
+    {
+        int poolnum = (int)((int64_t)gAudioBufferTime * gSampleRate / 1000 / 1024) + 2;
+        if (poolnum > FRAMEBUFFER_MAXBUFFER_AUDIO + 2) poolnum = FRAMEBUFFER_MAXBUFFER_AUDIO + 2;
+        Framebuffer_SetPool(FRAMEBUFFER_TYPE_AUDIO, 0, poolnum);  // payload is decoded frame (see AudioStream_ReadAndBuffer)
+    }
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_AUDIOWAVE, obtained.samples * 4, FRAMEBUFFER_MAXBUFFER_AUDIOWAVE + 2);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_VIDEO, 0, gVideoBufferNum + 2);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_PRESENT, PRESENT_STATUS_SIZE, FRAMEBUFFER_MAXBUFFER_PRESENT + 2);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_APACKET, sizeof(AVPacket), FRAMEBUFFER_MAXBUFFER_APACKET + 2);
+    Framebuffer_SetPool(FRAMEBUFFER_TYPE_VPACKET, sizeof(AVPacket), FRAMEBUFFER_MAXBUFFER_VPACKET + 2);
+    
     // thread initialize
     if (!MUTEX_CREATE(gMutexBitmapWave)) {
         printf("Can not create mutex for AudioWave\n");
@@ -2530,6 +3120,30 @@ int main(int argc, char *argv[])
         printf("Can not create AudioWave Thread\n");
         exit(1);
     }
+    if (!MUTEX_CREATE(gMutexScreen)) {
+        printf("Can not create mutex for Presenter\n");
+        exit(1);
+    }
+    if (pthread_create(&gPresentTid, NULL,(void *)Present_Entry, (void *)NULL)) {
+        printf("Can not create Presenter Thread\n");
+        exit(1);
+    }
+    if (!MUTEX_CREATE(gMutexVideo)) {
+        printf("Can not create mutex for Video Decoder\n");
+        exit(1);
+    }
+    if (pthread_create(&gVideoTid, NULL,(void *)VideoDecode_Entry, (void *)NULL)) {
+        printf("Can not create Video Decoder Thread\n");
+        exit(1);
+    }
+    if (!MUTEX_CREATE(gMutexDemux)) {
+        printf("Can not create mutex for Demuxer\n");
+        exit(1);
+    }
+    if (pthread_create(&gDemuxTid, NULL,(void *)Demux_Entry, (void *)NULL)) {
+        printf("Can not create Demuxer Thread\n");
+        exit(1);
+    }
     
     // ===== now! all initialize is successful =====
     
@@ -2538,7 +3152,9 @@ int main(int argc, char *argv[])
     //gStartTime = (int64_t)GetTickCount() * 1000;
     //SDL_PauseAudio(0);
     if (!gDebugDecode) {
+        MUTEX_LOCK(gMutexScreen);
         TextScreen_ClearScreen();
+        MUTEX_UNLOCK(gMutexScreen);
     }
     
     {  // input file check
@@ -2638,7 +3254,7 @@ int main(int argc, char *argv[])
         */
         // no more presentation then loop end and quit (playlist: play next)
         if (gReadDoneAudio && gReadDoneVideo && 
-                    (Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIO) < 16) &&
+                    (Framebuffer_ListDuration(FRAMEBUFFER_TYPE_AUDIO) < (int64_t)gAudioBufferTime * 1000 / 2) &&
                     !Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO) ) {
             if (Playlist_GetCurrentPlay() >= 0) {
                 if( Framebuffer_ListNum(FRAMEBUFFER_TYPE_AUDIO) ) {
@@ -2661,6 +3277,9 @@ int main(int argc, char *argv[])
             }
         }
         
+        // free audio nodes used by SDL callback (also after end of read)
+        Framebuffer_Reclaim(FRAMEBUFFER_TYPE_AUDIO);
+        
         // read audio and video
         {  // experimental 20150228  audio read 3times of video one.
             int i;
@@ -2672,11 +3291,7 @@ int main(int argc, char *argv[])
                 }
             }
         }
-        if (!gReadDoneVideo && !gPause) {
-            if (VideoStream_ReadAndBuffer() < 0) {
-                gReadDoneVideo = 1;
-            }
-        }
+        // (video is read by video decode thread)
         gSeeked = 0;
         
         /*
@@ -2706,17 +3321,18 @@ int main(int argc, char *argv[])
             if (Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO) && !gPause) {
                 pts = Framebuffer_GetPts(FRAMEBUFFER_TYPE_VIDEO);
                 
-                if ((gReadDoneAudio || isFramebuffer_Full(FRAMEBUFFER_TYPE_AUDIO)) && (gReadDoneVideo || isFramebuffer_Full(FRAMEBUFFER_TYPE_VIDEO))) {
+                if (gReadDoneAudio || isCuedata_Full(FRAMEBUFFER_TYPE_AUDIO)) {
                     int64_t stime;
                     stime = pts - ((int64_t)GetTickCount() * 1000 - gStartTime) - (10*1000);
                     if (stime > 100000) stime = 100000;
-                    if (stime > 0) Sleep(stime / 1000);
+                    if (stime > 0) Do_WaitBuffer(stime / 1000);
                 }
                 
                 if (pts < ((int64_t)GetTickCount() * 1000 - gStartTime)) {
                     gVDiff = ((int64_t)GetTickCount() * 1000 - gStartTime) - pts;
                     
                     skip = 0;
+                    fbuf = NULL;
                     if ((video_stream_index != -1) && 1) {  // frame skip (experimental 20150228)
                         int num, den, fps, dur;
                         den = fmt_ctx->streams[video_stream_index]->avg_frame_rate.den;
@@ -2725,15 +3341,11 @@ int main(int argc, char *argv[])
                             fps = num / den;
                             if (fps >= 12) {
                                 dur = 1000000 / fps;
-                                if (gVDiff > dur * 3) {  // 3 frames late then skip next picture
-                                    while ((Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO) > 0) && 
-                                            (Framebuffer_GetPts(FRAMEBUFFER_TYPE_VIDEO) < ((int64_t)GetTickCount() * 1000 - gStartTime))) {
-                                        fbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
-                                        if (fbuf) {
-                                            TextScreen_FreeBitmap((TextScreenBitmap *)fbuf->data);
-                                            Framebuffer_Free(fbuf);
-                                        }
-                                    }
+                                if (gVDiff > dur * 3) {  // 3 frames late then show newest due picture
+                                    int dropped;
+                                    
+                                    fbuf = Framebuffer_GetForTime(FRAMEBUFFER_TYPE_VIDEO,
+                                                        (int64_t)GetTickCount() * 1000 - gStartTime, &dropped);
                                     /*
                                     fbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
                                     if (fbuf) {
@@ -2742,37 +3354,37 @@ int main(int argc, char *argv[])
                                     }
                                     */
                                     //printf("Skipped ");
-                                    gFrameDrop = 1;
+                                    if (dropped) gFrameDrop = 1;
                                     skip = 1;
                                 }
                             }
                         }
                     }
                     
-                    if (!skip) {
-                        fbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
+                    {
+                        if (!skip) fbuf = Framebuffer_Get(FRAMEBUFFER_TYPE_VIDEO);
                         if (fbuf) {
+                            int showframe = 0;
+                            
                             if (gBitmapClip) {
-                                TextScreen_FreeBitmap(gBitmapClip);
+                                TextScreen_ReleaseBitmap(gBitmapClip);
                                 gBitmapClip = NULL;
                             }
                             if (gBitmapLastVideo) {
-                                TextScreen_FreeBitmap(gBitmapLastVideo);
+                                TextScreen_ReleaseBitmap(gBitmapLastVideo);
                                 gBitmapLastVideo = NULL;
                             }
                             bitmap = (TextScreenBitmap *)fbuf->data;
-                            gBitmapLastVideo = TextScreen_DupBitmap(bitmap);
+                            gBitmapLastVideo = TextScreen_ShareBitmap(bitmap);  // copied only if frame is drawn on
                             
                             if (gShowPlaylist) {
                                 if (!gBitmapList) gBitmapList = TextScreen_DupBitmap(gBitmap);
                                 TextScreen_ClearBitmap(gBitmap);
                                 Do_DrawPlaylist(gBitmap);
                                 if (TextScreen_CompareBitmap(gBitmap, gBitmapList, 0, 0)) {
-                                    TextScreen_ShowBitmap(gBitmap, 0, 0);
+                                    showframe = 1;
                                     if (gBitmapList) TextScreen_FreeBitmap(gBitmapList);
                                     gBitmapList = TextScreen_DupBitmap(gBitmap);
-                                } else {
-                                    TextScreen_SetCursorPos(0, 0);
                                 }
                                 gBitmapClip = TextScreen_DupBitmap(gBitmap);
                             } else {
@@ -2782,26 +3394,26 @@ int main(int argc, char *argv[])
                                         TextScreen_CopyBitmap(bitmap, gBitmapWave, 0, 0);
                                         MUTEX_UNLOCK(gMutexBitmapWave);
                                         Do_DrawInfo(bitmap);
-                                        TextScreen_ShowBitmap(bitmap, 0, 0);
+                                        showframe = 1;
                                         gBitmapClip = bitmap;
                                     }
                                 } else {
                                     Do_DrawInfo(bitmap);
-                                    TextScreen_ShowBitmap(bitmap, 0, 0);
+                                    showframe = 1;
                                     gBitmapClip = bitmap;
                                 }
                             }
+                            if (gBitmapClip == bitmap) fbuf->data = NULL;  // bitmap is kept as gBitmapClip
                             Framebuffer_Free(fbuf);
-                            TextScreen_SetCursorPos(0, gBitmap->height + screen.topMargin);
-                            Do_DrawStatus();
+                            // frame is written by presenter thread
+                            Present_Post(showframe ? TextScreen_ShareBitmap(gBitmapClip) : NULL, gBitmap->height + screen.topMargin);
                         }
                         //Do_DrawStatus();
                     }
                 }
             } else {
                 
-                if ((gReadDoneAudio || isFramebuffer_Full(FRAMEBUFFER_TYPE_AUDIO)) && 
-                    (gReadDoneVideo || isFramebuffer_Full(FRAMEBUFFER_TYPE_VIDEO)) && !gPause) {
+                if ((gReadDoneAudio || isCuedata_Full(FRAMEBUFFER_TYPE_AUDIO)) && !gPause) {
                     int64_t stime;
                     
                     stime = pts - ((int64_t)GetTickCount() * 1000 - gStartTime) - (0*1000);
@@ -2809,17 +3421,19 @@ int main(int argc, char *argv[])
                         pts = ((int64_t)GetTickCount() * 1000 - gStartTime);
                     }
                     if (stime > 100000) stime = 100000;
-                    if (stime > 0) Sleep(stime / 1000);
+                    if (stime > 0) Do_WaitBuffer(stime / 1000);
                 }
                 
                 if ((pts < ((int64_t)GetTickCount() * 1000 - gStartTime)) || gPause) {
+                    int showframe = 0;
+                    
                     if (!gPause) {
                         gVDiff = ((int64_t)GetTickCount() * 1000 - gStartTime) - pts;
                     } else {
                         gVDiff = 0;
                     }
                     if (gBitmapClip) {
-                        TextScreen_FreeBitmap(gBitmapClip);
+                        TextScreen_ReleaseBitmap(gBitmapClip);
                         gBitmapClip = NULL;
                     }
                     if (gShowPlaylist) {
@@ -2827,11 +3441,9 @@ int main(int argc, char *argv[])
                         TextScreen_ClearBitmap(gBitmap);
                         Do_DrawPlaylist(gBitmap);
                         if (TextScreen_CompareBitmap(gBitmap, gBitmapList, 0, 0)) {
-                            TextScreen_ShowBitmap(gBitmap, 0, 0);
+                            showframe = 1;
                             if (gBitmapList) TextScreen_FreeBitmap(gBitmapList);
                             gBitmapList = TextScreen_DupBitmap(gBitmap);
-                        } else {
-                            TextScreen_SetCursorPos(0, 0);
                         }
                         gBitmapClip = TextScreen_DupBitmap(gBitmap);
                     } else {
@@ -2841,7 +3453,7 @@ int main(int argc, char *argv[])
                                 TextScreen_CopyBitmap(gBitmap, gBitmapWave, 0, 0);
                                 MUTEX_UNLOCK(gMutexBitmapWave);
                                 Do_DrawInfo(gBitmap);
-                                TextScreen_ShowBitmap(gBitmap, 0, 0);
+                                showframe = 1;
                                 gBitmapClip = TextScreen_DupBitmap(gBitmap);
                             }
                         } else {
@@ -2854,23 +3466,32 @@ int main(int argc, char *argv[])
                             }
                             
                             Do_DrawInfo(gBitmap);
-                            TextScreen_ShowBitmap(gBitmap, 0, 0);
+                            showframe = 1;
                             gBitmapClip = TextScreen_DupBitmap(gBitmap);
                         }
                     }
-                    TextScreen_SetCursorPos(0, gBitmap->height + screen.topMargin);
-                    Do_DrawStatus();
-                    pts = (int64_t)GetTickCount() * 1000 - gStartTime + 40000;
+                    // frame is written by presenter thread
+                    Present_Post(showframe ? TextScreen_ShareBitmap(gBitmapClip) : NULL, gBitmap->height + screen.topMargin);
+                    pts = (int64_t)GetTickCount() * 1000 - gStartTime +
+                          ((gFramePacing && (gPaceInterval > 40000)) ? gPaceInterval : 40000);
                 }
             }
         }
         
         Do_Resize_Check();
         Do_Keyboard_Check();
+        Do_StatsLog();
         if (gPause) {
             Sleep(40);
-        } else {
-            Sleep(0);
+        } else if (gReadDoneAudio || isCuedata_Full(FRAMEBUFFER_TYPE_AUDIO)) {
+            // nothing to read (video is read by video decode thread). sleep until audio buffer has space or next video frame
+            int64_t stime = 10000;
+            
+            if (Framebuffer_ListNum(FRAMEBUFFER_TYPE_VIDEO)) {
+                stime = Framebuffer_GetPts(FRAMEBUFFER_TYPE_VIDEO) - ((int64_t)GetTickCount() * 1000 - gStartTime);
+                if (stime > 10000) stime = 10000;
+            }
+            Do_WaitBuffer(stime / 1000);
         }
         // SetThreadExecutionState(ES_SYSTEM_REQUIRED | ES_DISPLAY_REQUIRED | ES_CONTINUOUS);
     }
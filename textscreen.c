@@ -33,10 +33,24 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+// pshufb kernel is compiled for ssse3 and selected at run time (build does not need -mssse3)
+#define TEXTSCREEN_MAP_SSSE3
+#define TEXTSCREEN_TARGET_SSSE3 __attribute__((target("ssse3")))
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "textscreen.h"
 
@@ -50,6 +64,31 @@
 #define SCREEN_DEFAULT_SAR                2
 #define SCREEN_DEFAULT_SPACE_CHAR         ' '
 #ifdef _WIN32
+// METHOD_DIFF: each run is one WriteConsoleOutputCharacter call, full repaint is one bulk write.
+// cost of a call is counted as this many bytes, and runs are joined over gaps up to the same size
+// (so a busy frame is written in a few calls per row at most, or falls back to full repaint)
+#define SCREEN_DIFF_GAP                   128
+#define SCREEN_DIFF_MOVE_COST             128
+#else
+// METHOD_DIFF: unchanged cells shorter than this between changed cells are output (cheaper than move cursor)
+#define SCREEN_DIFF_GAP                   8
+// METHOD_DIFF: estimated bytes to move cursor ("\x1b[yy;xxH")
+#define SCREEN_DIFF_MOVE_COST             8
+#endif
+// row hash (FNV-1a 64bit)
+#define SCREEN_ROWHASH_BASIS              0xcbf29ce484222325ULL
+#define SCREEN_ROWHASH_PRIME              0x00000100000001b3ULL
+// max number of bitmaps kept by bitmap pool
+#define SCREEN_POOL_MAX                   16
+// bitmap pool lock (gcc __atomic builtins. pool is used from several threads)
+#define SCREEN_POOL_LOCK()    while (__atomic_test_and_set(&gPoolLock, __ATOMIC_ACQUIRE)) TextScreen_Wait(0)
+#define SCREEN_POOL_UNLOCK()  __atomic_clear(&gPoolLock, __ATOMIC_RELEASE)
+// reference count of shared bitmap data
+#define SCREEN_REF_LOAD(x)    __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define SCREEN_REF_ADD(x, v)  __atomic_add_fetch(&(x), (v), __ATOMIC_ACQ_REL)
+// max number of ranges for range translate kernel (table = identity except ranges replaced by one character)
+#define SCREEN_TRANSLATE_MAXRANGE         4
+#ifdef _WIN32
 // #define SCREEN_DEFAULT_RENDERING_METHOD   TEXTSCREEN_RENDERING_METHOD_WINCONSOLE
 #define SCREEN_DEFAULT_RENDERING_METHOD   TEXTSCREEN_RENDERING_METHOD_FAST
 #else
@@ -77,6 +116,266 @@ static unsigned char gTranslateTable[256] = {
     0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0x20, 0x20, 0x20 };
 
 static TextScreenSetting gSetting = {0};
+static void (*gMemoryCallback)(int delta) = NULL;
+
+// output buffer (written by one write per frame)
+static char *gOutBuf  = NULL;
+static int  gOutSize  = 0;
+static int  gOutLen   = 0;
+static int  gOutBatch = 0;   // 1: between TextScreen_BeginOutput() and TextScreen_FlushOutput()
+static int  gOutStatBytes = 0;  // written bytes since last TextScreen_GetOutputStats()
+static int  gOutStatUsec  = 0;  // time spent for writing (usec) since last TextScreen_GetOutputStats()
+static int TextScreen_OutputWrite(void);
+static int TextScreen_OutputCursor(int x, int y);
+
+// bitmap pool (released bitmaps for reuse by TextScreen_AcquireBitmap, TextScreen_DupBitmap)
+static TextScreenBitmap *gPool[SCREEN_POOL_MAX];
+static int  gPoolNum = 0;
+static char gPoolLock = 0;
+
+// METHOD_DIFF: characters of screen area shown by previous frame
+static char *gDiffPrev = NULL;
+static char *gDiffCur  = NULL;
+static int  gDiffSize  = 0;   // size of gDiffPrev and gDiffCur
+static int  gDiffWidth = 0;
+static int  gDiffHeight = 0;
+static int  gDiffValid = 0;
+static unsigned long long *gDiffRowHash = NULL;  // row hash of bitmap shown as previous frame
+static char *gDiffRowSame = NULL;               // 1: row is same as previous frame
+static int  gDiffRowHashSize = 0;
+static int  gDiffBitmapWidth = 0;
+static int  gDiffDx = 0;
+static int  gDiffDy = 0;
+
+// translate kernel (selected by TextScreen_SetupTranslate)
+static void TextScreen_TranslateTable(char *dst, const char *src, int len);
+static void (*gTranslateKernel)(char *dst, const char *src, int len) = TextScreen_TranslateTable;
+static int  gTranslateRanges = 0;
+static unsigned char gTranslateLo[SCREEN_TRANSLATE_MAXRANGE];
+static unsigned char gTranslateSpan[SCREEN_TRANSLATE_MAXRANGE];  // hi - lo
+static unsigned char gTranslateChar = 0;
+
+// translate with table (scalar)
+static void TextScreen_TranslateTable(char *dst, const char *src, int len)
+{
+    const unsigned char *table;
+    const unsigned char *s;
+    int i;
+    
+    table = (const unsigned char *)gSetting.translate;
+    s = (const unsigned char *)src;
+    for (i = 0; i + 4 <= len; i += 4) {
+        dst[i    ] = table[s[i    ]];
+        dst[i + 1] = table[s[i + 1]];
+        dst[i + 2] = table[s[i + 2]];
+        dst[i + 3] = table[s[i + 3]];
+    }
+    for (; i < len; i++)
+        dst[i] = table[s[i]];
+}
+
+// translate table is identity
+static void TextScreen_TranslateCopy(char *dst, const char *src, int len)
+{
+    memcpy(dst, src, len);
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// translate table is identity except gTranslateRanges ranges (16 characters at once)
+static void TextScreen_TranslateRange(char *dst, const char *src, int len)
+{
+    int i, r;
+#if defined(__SSE2__)
+    __m128i lo[SCREEN_TRANSLATE_MAXRANGE], span[SCREEN_TRANSLATE_MAXRANGE];
+    __m128i repl, v, d, m;
+    
+    for (r = 0; r < gTranslateRanges; r++) {
+        lo[r]   = _mm_set1_epi8((char)gTranslateLo[r]);
+        span[r] = _mm_set1_epi8((char)gTranslateSpan[r]);
+    }
+    repl = _mm_set1_epi8((char)gTranslateChar);
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(src + i));
+        m = _mm_setzero_si128();
+        for (r = 0; r < gTranslateRanges; r++) {
+            // (v - lo) <= span  (unsigned)
+            d = _mm_sub_epi8(v, lo[r]);
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(d, span[r]), d));
+        }
+        v = _mm_or_si128(_mm_and_si128(m, repl), _mm_andnot_si128(m, v));
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+#else
+    uint8x16_t lo[SCREEN_TRANSLATE_MAXRANGE], span[SCREEN_TRANSLATE_MAXRANGE];
+    uint8x16_t repl, v, m;
+    
+    for (r = 0; r < gTranslateRanges; r++) {
+        lo[r]   = vdupq_n_u8(gTranslateLo[r]);
+        span[r] = vdupq_n_u8(gTranslateSpan[r]);
+    }
+    repl = vdupq_n_u8(gTranslateChar);
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = vld1q_u8((const uint8_t *)(src + i));
+        m = vdupq_n_u8(0);
+        for (r = 0; r < gTranslateRanges; r++)
+            m = vorrq_u8(m, vcleq_u8(vsubq_u8(v, lo[r]), span[r]));
+        vst1q_u8((uint8_t *)(dst + i), vbslq_u8(m, repl, v));
+    }
+#endif
+    if (i < len) TextScreen_TranslateTable(dst + i, src + i, len - i);
+}
+#endif
+
+// select translate kernel for gSetting.translate
+static void TextScreen_SetupTranslate(void)
+{
+    const unsigned char *table;
+    int i, ranges, repl;
+    
+    gTranslateKernel = TextScreen_TranslateTable;
+    table = (const unsigned char *)gSetting.translate;
+    if (!table) return;
+    
+    ranges = 0;
+    repl = -1;
+    for (i = 0; i < 256; i++) {
+        if (table[i] == i) continue;
+        if ((repl >= 0) && (table[i] != repl)) return;  // replaced by several characters
+        repl = table[i];
+        if (ranges && (gTranslateLo[ranges - 1] + gTranslateSpan[ranges - 1] == i - 1)) {
+            gTranslateSpan[ranges - 1]++;
+        } else {
+            if (ranges >= SCREEN_TRANSLATE_MAXRANGE) return;
+            gTranslateLo[ranges]   = i;
+            gTranslateSpan[ranges] = 0;
+            ranges++;
+        }
+    }
+    gTranslateRanges = ranges;
+    gTranslateChar   = (repl >= 0) ? repl : 0;
+    if (!ranges) {
+        gTranslateKernel = TextScreen_TranslateCopy;
+    } else {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        gTranslateKernel = TextScreen_TranslateRange;
+#endif
+    }
+}
+
+// translate cells (x, y) to (x + width - 1, y) of bitmap to dst (outside of bitmap is null character)
+static void TextScreen_TranslateRow(char *dst, const TextScreenBitmap *bitmap, int x, int y, int width)
+{
+    int  left, right;
+    char null;
+    
+    null = gSetting.translate[0];
+    if ((y < 0) || (y >= bitmap->height) || (x >= bitmap->width) || (x + width <= 0)) {
+        memset(dst, null, width);
+        return;
+    }
+    left  = (x < 0) ? -x : 0;
+    right = (x + width > bitmap->width) ? x + width - bitmap->width : 0;
+    if (left) memset(dst, null, left);
+    gTranslateKernel(dst + left, bitmap->data + y * bitmap->width + x + left, width - left - right);
+    if (right) memset(dst + width - right, null, right);
+}
+
+typedef void (*TextScreenMapKernel)(char *dst, const unsigned char *src, int len, const char *table);
+
+// map 8-bit samples to characters with 256-entry table (scalar)
+static void TextScreen_MapTable(char *dst, const unsigned char *src, int len, const char *table)
+{
+    int i;
+    
+    for (i = 0; i + 4 <= len; i += 4) {
+        dst[i    ] = table[src[i    ]];
+        dst[i + 1] = table[src[i + 1]];
+        dst[i + 2] = table[src[i + 2]];
+        dst[i + 3] = table[src[i + 3]];
+    }
+    for (; i < len; i++)
+        dst[i] = table[src[i]];
+}
+
+#if defined(TEXTSCREEN_MAP_SSSE3) || (defined(__ARM_NEON) && defined(__aarch64__))
+// map with table depending on upper 4 bits only (one 16-entry lookup per 16 samples)
+#if defined(TEXTSCREEN_MAP_SSSE3)
+TEXTSCREEN_TARGET_SSSE3
+#endif
+static void TextScreen_MapNibble(char *dst, const unsigned char *src, int len, const char *table)
+{
+    int i;
+#if defined(TEXTSCREEN_MAP_SSSE3)
+    __m128i tab, mask, v;
+    
+    tab  = _mm_setr_epi8(table[0x00], table[0x10], table[0x20], table[0x30], table[0x40], table[0x50], table[0x60], table[0x70],
+                         table[0x80], table[0x90], table[0xa0], table[0xb0], table[0xc0], table[0xd0], table[0xe0], table[0xf0]);
+    mask = _mm_set1_epi8(0x0f);
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + i)), 4), mask);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(tab, v));
+    }
+#else
+    uint8_t    tab16[16];
+    uint8x16_t tab;
+    
+    for (i = 0; i < 16; i++) tab16[i] = table[i << 4];
+    tab = vld1q_u8(tab16);
+    for (i = 0; i + 16 <= len; i += 16)
+        vst1q_u8((uint8_t *)(dst + i), vqtbl1q_u8(tab, vshrq_n_u8(vld1q_u8(src + i), 4)));
+#endif
+    if (i < len) TextScreen_MapTable(dst + i, src + i, len - i, table);
+}
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+// map with any 256-entry table (16 samples at once. pshufb needs 16 lookups for 256 entries: slower than scalar)
+static void TextScreen_MapShuffle(char *dst, const unsigned char *src, int len, const char *table)
+{
+    int i, k;
+    uint8x16x4_t tab[4];
+    uint8x16_t   step, v, r;
+    
+    for (k = 0; k < 4; k++) {
+        tab[k].val[0] = vld1q_u8((const uint8_t *)table + k * 64);
+        tab[k].val[1] = vld1q_u8((const uint8_t *)table + k * 64 + 16);
+        tab[k].val[2] = vld1q_u8((const uint8_t *)table + k * 64 + 32);
+        tab[k].val[3] = vld1q_u8((const uint8_t *)table + k * 64 + 48);
+    }
+    step = vdupq_n_u8(64);
+    for (i = 0; i + 16 <= len; i += 16) {
+        // tbl returns 0 for index 64 or more, tbx keeps r
+        v = vld1q_u8(src + i);
+        r = vqtbl4q_u8(tab[0], v);
+        v = vsubq_u8(v, step);
+        r = vqtbx4q_u8(r, tab[1], v);
+        v = vsubq_u8(v, step);
+        r = vqtbx4q_u8(r, tab[2], v);
+        v = vsubq_u8(v, step);
+        r = vqtbx4q_u8(r, tab[3], v);
+        vst1q_u8((uint8_t *)(dst + i), r);
+    }
+    if (i < len) TextScreen_MapTable(dst + i, src + i, len - i, table);
+}
+#endif
+
+// select map kernel for table (called once per bitmap)
+static TextScreenMapKernel TextScreen_MapSelect(const char *table)
+{
+    int i;
+    
+#if defined(TEXTSCREEN_MAP_SSSE3)
+    if (!__builtin_cpu_supports("ssse3")) return TextScreen_MapTable;
+#endif
+    for (i = 0; i < 256; i++) {
+#if defined(TEXTSCREEN_MAP_SSSE3)
+        if (table[i] != table[i & 0xf0]) return TextScreen_MapTable;
+#else
+        if (table[i] != table[i & 0xf0]) return TextScreen_MapShuffle;
+#endif
+    }
+    return TextScreen_MapNibble;
+}
+#endif
 
 void TextScreen_Init(TextScreenSetting *usersetting)
 {
@@ -85,10 +384,19 @@ void TextScreen_Init(TextScreenSetting *usersetting)
     } else {
         gSetting = *usersetting;
     }
+    TextScreen_SetupTranslate();
+    TextScreen_InvalidateScreen();
+}
+
+void TextScreen_InvalidateScreen(void)
+{
+    gDiffValid = 0;
 }
 
 int TextScreen_ClearScreen(void)
 {
+    TextScreen_OutputWrite();
+    TextScreen_InvalidateScreen();
 #ifdef _WIN32
     HANDLE stdh;
     COORD  coord;
@@ -160,7 +468,6 @@ int TextScreen_SetCursorPos(int x, int y)
 {
 #ifdef _WIN32
     HANDLE stdouth;
-    COORD  coord;
     CONSOLE_SCREEN_BUFFER_INFO info;
     int    width, height;
     int    ret;
@@ -181,20 +488,16 @@ int TextScreen_SetCursorPos(int x, int y)
     if (y < 0) y = 0;
     if (y >= height) y = height - 1;
     
-    coord.X = x;
-    coord.Y = y;
-    SetConsoleCursorPosition(stdouth ,coord);
+    return TextScreen_OutputCursor(x, y);
 #else
-    char strbuf[32];
-    
     if (x < 0) x = 0;
     if (y < 0) y = 0;
     if (x > 32767) x = 32767;
     if (y > 32767) y = 32767;
-    snprintf(strbuf, sizeof(strbuf), "\x1b[%d;%dH", y+1, x+1);
-    printf("%s", strbuf);   // set cursor position "\x1b[yy;xxH"
-#endif
+    if (TextScreen_OutputCursor(x, y)) return -1;   // set cursor position "\x1b[yy;xxH"
+    if (!gOutBatch) return TextScreen_OutputWrite();
     return 0;
+#endif
 }
 
 int TextScreen_SetCursorVisible(int visible)
@@ -315,7 +618,7 @@ void TextScreen_DrawCircle(const TextScreenBitmap *bitmap, int x, int y, int r,
 void TextScreen_DrawFillRect(const TextScreenBitmap *bitmap, int x, int y, int w, int h, char ch)
 {
     int xmin, xmax, ymin, ymax;
-    int xc, yc;
+    int yc;
     
     if (!bitmap) return;
     xmin = x;
@@ -327,11 +630,12 @@ void TextScreen_DrawFillRect(const TextScreenBitmap *bitmap, int x, int y, int w
     if (xmax > bitmap->width) xmax = bitmap->width;
     if (ymin < 0) ymin = 0;
     if (ymax > bitmap->height) ymax = bitmap->height;
+    if ((xmin >= xmax) || (ymin >= ymax)) return;
+    if (TextScreen_UnshareBitmap(bitmap)) return;
 
     for (yc = ymin; yc < ymax; yc++) {
-        for (xc = xmin; xc < xmax; xc++) {
-            TextScreen_PutCell(bitmap, xc, yc, ch);
-        }
+        memset(bitmap->data + yc * bitmap->width + xmin, ch, xmax - xmin);
+        if (bitmap->rowhash) bitmap->rowhash[yc] = 0;
     }
 }
 
@@ -463,30 +767,67 @@ char TextScreen_GetCell(const TextScreenBitmap *bitmap, int x, int y)
 void TextScreen_PutCell(const TextScreenBitmap *bitmap, int x, int y, char ch)
 {
     if (!bitmap) return;
-    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height)) {
+        if (bitmap->refcount && TextScreen_UnshareBitmap(bitmap)) return;
         *(bitmap->data + y * bitmap->width + x) = ch;
+        if (bitmap->rowhash) bitmap->rowhash[y] = 0;
+    }
 }
 
 void TextScreen_ClearCell(const TextScreenBitmap *bitmap, int x, int y)
 {
     if (!bitmap) return;
-    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height)) {
+        if (bitmap->refcount && TextScreen_UnshareBitmap(bitmap)) return;
         *(bitmap->data + y * bitmap->width + x) = gSetting.space;
+        if (bitmap->rowhash) bitmap->rowhash[y] = 0;
+    }
+}
+
+// calculate content hash of row y (cached in rowhash unless shared: shared data is read only). return 0: no row tracking
+// (TextScreen_ShareBitmap fills all rows before data is shared, so shared bitmap has cached hashes)
+static unsigned long long TextScreen_RowHash(const TextScreenBitmap *bitmap, int y)
+{
+    unsigned long long hash;
+    const unsigned char *p;
+    int x;
+    
+    if (!bitmap->rowhash) return 0;
+    if (bitmap->rowhash[y]) return bitmap->rowhash[y];
+    
+    hash = SCREEN_ROWHASH_BASIS;
+    p = (const unsigned char *)(bitmap->data + y * bitmap->width);
+    for (x = 0; x < bitmap->width; x++) {
+        hash ^= *(p++);
+        hash *= SCREEN_ROWHASH_PRIME;
+    }
+    if (!hash) hash = 1;
+    if (!bitmap->refcount) bitmap->rowhash[y] = hash;
+    
+    return hash;
+}
+
+void TextScreen_SetMemoryCallback(void (*callback)(int delta))
+{
+    gMemoryCallback = callback;
 }
 
 TextScreenBitmap *TextScreen_CreateBitmap(int width, int height)
 {
     TextScreenBitmap *bitmap;
     char *data;
+    unsigned long long *rowhash;
     
     if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
         return NULL;
     }
     bitmap = (TextScreenBitmap *)malloc(sizeof(TextScreenBitmap));
     data   = (char *)malloc(width * height);
-    if (!bitmap || !data) {
-        if (bitmap) free(bitmap);
-        if (data)   free(data);
+    rowhash = (unsigned long long *)calloc(height, sizeof(unsigned long long));
+    if (!bitmap || !data || !rowhash) {
+        if (bitmap)  free(bitmap);
+        if (data)    free(data);
+        if (rowhash) free(rowhash);
         return NULL;
     }
     
@@ -494,7 +835,10 @@ TextScreenBitmap *TextScreen_CreateBitmap(int width, int height)
     bitmap->height = height;
     bitmap->exdata = NULL;
     bitmap->data   = data;
+    bitmap->rowhash = rowhash;
+    bitmap->refcount = NULL;
     TextScreen_ClearBitmap(bitmap);
+    if (gMemoryCallback) gMemoryCallback(width * height);
     
     return bitmap;
 }
@@ -502,57 +846,311 @@ TextScreenBitmap *TextScreen_CreateBitmap(int width, int height)
 void TextScreen_FreeBitmap(TextScreenBitmap *bitmap)
 {
     if (bitmap) {
-        if (bitmap->data)
+        if (bitmap->refcount) {
+            if (SCREEN_REF_ADD(*bitmap->refcount, -1) > 0) {  // data is used by other handle
+                free(bitmap);
+                return;
+            }
+            free(bitmap->refcount);
+        }
+        if (bitmap->data) {
             free(bitmap->data);
+            if (gMemoryCallback) gMemoryCallback(-(bitmap->width * bitmap->height));
+        }
+        if (bitmap->rowhash) free(bitmap->rowhash);
         free(bitmap);
     }
 }
 
+// get bitmap of same size from pool (contents are not cleared). return NULL: not found
+static TextScreenBitmap *TextScreen_PoolGet(int width, int height)
+{
+    TextScreenBitmap *bitmap;
+    int i;
+    
+    bitmap = NULL;
+    SCREEN_POOL_LOCK();
+    for (i = gPoolNum - 1; i >= 0; i--) {
+        if ((gPool[i]->width == width) && (gPool[i]->height == height)) {
+            bitmap = gPool[i];
+            gPool[i] = gPool[--gPoolNum];
+            break;
+        }
+    }
+    SCREEN_POOL_UNLOCK();
+    if (bitmap) bitmap->exdata = NULL;
+    
+    return bitmap;
+}
+
+TextScreenBitmap *TextScreen_AcquireBitmap(int width, int height)
+{
+    TextScreenBitmap *bitmap;
+    
+    bitmap = TextScreen_PoolGet(width, height);
+    if (!bitmap) return TextScreen_CreateBitmap(width, height);
+    TextScreen_ClearBitmap(bitmap);
+    
+    return bitmap;
+}
+
+void TextScreen_ReleaseBitmap(TextScreenBitmap *bitmap)
+{
+    TextScreenBitmap *evict;
+    int i;
+    
+    if (!bitmap) return;
+    if (!bitmap->data || !bitmap->rowhash) {  // not created by TextScreen
+        TextScreen_FreeBitmap(bitmap);
+        return;
+    }
+    if (bitmap->refcount) {
+        if (SCREEN_REF_ADD(*bitmap->refcount, -1) > 0) {  // data is used by other handle
+            free(bitmap);
+            return;
+        }
+        free(bitmap->refcount);
+        bitmap->refcount = NULL;
+    }
+    evict = NULL;
+    SCREEN_POOL_LOCK();
+    if (gPoolNum >= SCREEN_POOL_MAX) {  // pool is full: free oldest one
+        evict = gPool[0];
+        for (i = 1; i < gPoolNum; i++)
+            gPool[i - 1] = gPool[i];
+        gPoolNum--;
+    }
+    gPool[gPoolNum++] = bitmap;
+    SCREEN_POOL_UNLOCK();
+    if (evict) TextScreen_FreeBitmap(evict);
+}
+
+void TextScreen_FlushBitmapPool(void)
+{
+    TextScreenBitmap *pool[SCREEN_POOL_MAX];
+    int i, num;
+    
+    SCREEN_POOL_LOCK();
+    num = gPoolNum;
+    for (i = 0; i < num; i++)
+        pool[i] = gPool[i];
+    gPoolNum = 0;
+    SCREEN_POOL_UNLOCK();
+    for (i = 0; i < num; i++)
+        TextScreen_FreeBitmap(pool[i]);
+}
+
+TextScreenBitmap *TextScreen_ShareBitmap(const TextScreenBitmap *bitmap)
+{
+    TextScreenBitmap *map, *newmap;
+    int y;
+    
+    if (!bitmap) return NULL;
+    if (!bitmap->rowhash) return TextScreen_DupBitmap(bitmap);  // not created by TextScreen
+    
+    map = (TextScreenBitmap *)bitmap;  // only refcount of handle is changed
+    newmap = (TextScreenBitmap *)malloc(sizeof(TextScreenBitmap));
+    if (!newmap) return NULL;
+    if (!map->refcount) {
+        // hash rows while data is exclusive (METHOD_DIFF of other handle reuses them)
+        if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_DIFF) {
+            for (y = 0; y < map->height; y++)
+                TextScreen_RowHash(map, y);
+        }
+        map->refcount = (int *)malloc(sizeof(int));
+        if (!map->refcount) {
+            free(newmap);
+            return TextScreen_DupBitmap(bitmap);
+        }
+        *map->refcount = 1;
+    }
+    SCREEN_REF_ADD(*map->refcount, 1);
+    *newmap = *map;
+    newmap->exdata = NULL;
+    
+    return newmap;
+}
+
+// make bitmap data exclusive. copy: 0 contents are not copied (will be overwritten)
+static int TextScreen_UnshareData(const TextScreenBitmap *bitmap, int copy)
+{
+    TextScreenBitmap *map, *pooled;
+    char *data;
+    unsigned long long *rowhash;
+    int  size;
+    
+    if (!bitmap || !bitmap->refcount) return 0;
+    
+    map = (TextScreenBitmap *)bitmap;  // contents are same, only data handle is changed
+    if (SCREEN_REF_LOAD(*map->refcount) > 1) {
+        size = map->width * map->height;
+        pooled = TextScreen_PoolGet(map->width, map->height);
+        if (pooled) {  // use data of pooled bitmap
+            data    = pooled->data;
+            rowhash = pooled->rowhash;
+            free(pooled);
+        } else {
+            data = (char *)malloc(size);
+            rowhash = (unsigned long long *)malloc(map->height * sizeof(unsigned long long));
+            if (!data || !rowhash) {
+                if (data)    free(data);
+                if (rowhash) free(rowhash);
+                return -1;
+            }
+            if (gMemoryCallback) gMemoryCallback(size);
+        }
+        if (copy) {
+            memcpy(data, map->data, size);
+            memcpy(rowhash, map->rowhash, map->height * sizeof(unsigned long long));
+        }
+        if (SCREEN_REF_ADD(*map->refcount, -1) == 0) {  // other handles are freed meanwhile
+            free(map->data);
+            free(map->rowhash);
+            free(map->refcount);
+            if (gMemoryCallback) gMemoryCallback(-size);
+        }
+        map->data    = data;
+        map->rowhash = rowhash;
+    } else {
+        free(map->refcount);
+    }
+    map->refcount = NULL;
+    
+    return 0;
+}
+
+int TextScreen_UnshareBitmap(const TextScreenBitmap *bitmap)
+{
+    return TextScreen_UnshareData(bitmap, 1);
+}
+
 void TextScreen_CopyBitmap(const TextScreenBitmap *dstmap, const TextScreenBitmap *srcmap, int dx, int dy)
 {
-    int x, y;
+    int xmin, xmax, y, yd;
+    int fullrow;
     
     if (!srcmap || !dstmap) return;
     
+    // clip source x range to destination
+    xmin = (dx < 0) ? -dx : 0;
+    xmax = (dstmap->width - dx < srcmap->width) ? dstmap->width - dx : srcmap->width;
+    fullrow = (dx == 0) && (srcmap->width == dstmap->width);
+    
     for (y = 0; y < srcmap->height; y++) {
-        for (x = 0; x < srcmap->width; x++) {
-            TextScreen_PutCell(dstmap, x + dx, y + dy, TextScreen_GetCell(srcmap, x, y));
+        yd = y + dy;
+        if ((yd < 0) || (yd >= dstmap->height)) continue;
+        if (fullrow) {
+            // skip row of same content
+            if (dstmap->rowhash && dstmap->rowhash[yd] && (dstmap->rowhash[yd] == TextScreen_RowHash(srcmap, y)))
+                continue;
+            if (dstmap->refcount && TextScreen_UnshareBitmap(dstmap)) return;
+            memmove(dstmap->data + yd * dstmap->width, srcmap->data + y * srcmap->width, srcmap->width);
+            if (dstmap->rowhash) dstmap->rowhash[yd] = srcmap->rowhash ? srcmap->rowhash[y] : 0;
+        } else if (xmin < xmax) {
+            if (dstmap->refcount && TextScreen_UnshareBitmap(dstmap)) return;
+            memmove(dstmap->data + yd * dstmap->width + xmin + dx, srcmap->data + y * srcmap->width + xmin, xmax - xmin);
+            if (dstmap->rowhash) dstmap->rowhash[yd] = 0;
         }
     }
 }
 
+void TextScreen_MapBitmap(const TextScreenBitmap *bitmap, const unsigned char *src, int linesize,
+                          int width, int height, const char *table)
+{
+    TextScreenMapKernel kernel;
+    int y;
+    
+    if (!bitmap || !src || !table) return;
+    if (bitmap->refcount && TextScreen_UnshareBitmap(bitmap)) return;
+    if (width > bitmap->width) width = bitmap->width;
+    if (height > bitmap->height) height = bitmap->height;
+    if ((width <= 0) || (height <= 0)) return;
+    
+#if defined(TEXTSCREEN_MAP_SSSE3) || (defined(__ARM_NEON) && defined(__aarch64__))
+    kernel = TextScreen_MapSelect(table);
+#else
+    kernel = TextScreen_MapTable;
+#endif
+    
+    for (y = 0; y < height; y++) {
+        kernel(bitmap->data + y * bitmap->width, src + y * linesize, width, table);
+        if (bitmap->rowhash) bitmap->rowhash[y] = 0;
+    }
+}
+
 TextScreenBitmap *TextScreen_DupBitmap(const TextScreenBitmap *bitmap)
 {
     TextScreenBitmap *newmap;
     
     if (!bitmap) return NULL;
     
-    newmap = TextScreen_CreateBitmap(bitmap->width, bitmap->height);
+    newmap = TextScreen_PoolGet(bitmap->width, bitmap->height);
+    if (!newmap) newmap = TextScreen_CreateBitmap(bitmap->width, bitmap->height);
     if (newmap) {
-        TextScreen_CopyBitmap(newmap, bitmap, 0, 0);
+        memcpy(newmap->data, bitmap->data, bitmap->width * bitmap->height);
+        if (bitmap->rowhash) {
+            memcpy(newmap->rowhash, bitmap->rowhash, bitmap->height * sizeof(unsigned long long));
+        } else {
+            memset(newmap->rowhash, 0, bitmap->height * sizeof(unsigned long long));
+        }
     }
     return newmap;
 }
 
 void TextScreen_OverlayBitmap(const TextScreenBitmap *dstmap, const TextScreenBitmap *srcmap, int dx, int dy)
 {
-    char ch;
-    int x, y;
+    const char *s;
+    char *d;
+    int  xmin, xmax, x, y, yd;
     
     if (!srcmap || !dstmap) return;
     
+    // clip source x range to destination
+    xmin = (dx < 0) ? -dx : 0;
+    xmax = (dstmap->width - dx < srcmap->width) ? dstmap->width - dx : srcmap->width;
+    if (xmin >= xmax) return;
+    if (TextScreen_UnshareBitmap(dstmap)) return;
+    
     for (y = 0; y < srcmap->height; y++) {
-        for (x = 0; x < srcmap->width; x++) {
-            ch = TextScreen_GetCell(srcmap, x, y);
-            if (ch != gSetting.space)
-                TextScreen_PutCell(dstmap, x + dx, y + dy, ch);
+        yd = y + dy;
+        if ((yd < 0) || (yd >= dstmap->height)) continue;
+        s = srcmap->data + y * srcmap->width + xmin;
+        d = dstmap->data + yd * dstmap->width + xmin + dx;
+        x = 0;
+#if defined(__SSE2__)
+        {
+            __m128i space, vs, vd, m;
+            
+            space = _mm_set1_epi8(gSetting.space);
+            for (; x + 16 <= xmax - xmin; x += 16) {
+                vs = _mm_loadu_si128((const __m128i *)(s + x));
+                vd = _mm_loadu_si128((const __m128i *)(d + x));
+                m  = _mm_cmpeq_epi8(vs, space);
+                _mm_storeu_si128((__m128i *)(d + x), _mm_or_si128(_mm_and_si128(m, vd), _mm_andnot_si128(m, vs)));
+            }
+        }
+#elif defined(__ARM_NEON)
+        {
+            uint8x16_t space, vs;
+            
+            space = vdupq_n_u8((uint8_t)gSetting.space);
+            for (; x + 16 <= xmax - xmin; x += 16) {
+                vs = vld1q_u8((const uint8_t *)(s + x));
+                vst1q_u8((uint8_t *)(d + x), vbslq_u8(vceqq_u8(vs, space), vld1q_u8((const uint8_t *)(d + x)), vs));
+            }
+        }
+#endif
+        for (; x < xmax - xmin; x++) {
+            if (s[x] != gSetting.space) d[x] = s[x];
         }
+        if (dstmap->rowhash) dstmap->rowhash[yd] = 0;
     }
 }
 
 int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int height)
 {
     char *data, *olddata;
+    unsigned long long *rowhash;
     int  oldwidth, oldheight;
     int  xc, yc;
     char ch;
@@ -561,8 +1159,18 @@ int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int
     if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
         return -1;
     }
+    if (TextScreen_UnshareBitmap(bitmap)) return -1;
     data   = (char *)malloc(width * height);
     if (!data) return -1;
+    if (bitmap->rowhash) {
+        rowhash = (unsigned long long *)calloc(height, sizeof(unsigned long long));
+        if (!rowhash) {
+            free(data);
+            return -1;
+        }
+        free(bitmap->rowhash);
+        bitmap->rowhash = rowhash;
+    }
     
     oldwidth  = bitmap->width;
     oldheight = bitmap->height;
@@ -584,6 +1192,7 @@ int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int
     }
     
     free(olddata);
+    if (gMemoryCallback) gMemoryCallback(width * height - oldwidth * oldheight);
     
     return 0;
 }
@@ -591,6 +1200,7 @@ int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int
 int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height)
 {
     char *data, *olddata;
+    unsigned long long *rowhash;
     int  oldwidth, oldheight;
     int  xc, yc;
     char ch;
@@ -599,8 +1209,18 @@ int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height)
     if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
         return -1;
     }
+    if (TextScreen_UnshareBitmap(bitmap)) return -1;
     data   = (char *)malloc(width * height);
     if (!data) return -1;
+    if (bitmap->rowhash) {
+        rowhash = (unsigned long long *)calloc(height, sizeof(unsigned long long));
+        if (!rowhash) {
+            free(data);
+            return -1;
+        }
+        free(bitmap->rowhash);
+        bitmap->rowhash = rowhash;
+    }
     
     oldwidth  = bitmap->width;
     oldheight = bitmap->height;
@@ -620,6 +1240,7 @@ int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height)
     }
     
     free(olddata);
+    if (gMemoryCallback) gMemoryCallback(width * height - oldwidth * oldheight);
     
     return 0;
 }
@@ -628,9 +1249,25 @@ int TextScreen_CompareBitmap(const TextScreenBitmap *dstmap, const TextScreenBit
 {
     int  x, y;
     char chsrc, chdst;
+    unsigned long long hsrc;
     
     if (!srcmap || !dstmap) return -1;
     
+    if ((dx == 0) && (dy == 0) && (srcmap->width == dstmap->width) && (srcmap->height == dstmap->height) &&
+        srcmap->rowhash && dstmap->rowhash) {
+        for (y = 0; y < srcmap->height; y++) {
+            hsrc = TextScreen_RowHash(srcmap, y);
+            if (hsrc == TextScreen_RowHash(dstmap, y)) continue;
+            for (x = 0; x < srcmap->width; x++) {
+                chsrc = srcmap->data[y * srcmap->width + x];
+                chdst = dstmap->data[y * dstmap->width + x];
+                if (chsrc > chdst) return 1;
+                if (chsrc < chdst) return -1;
+            }
+        }
+        return 0;
+    }
+    
     for (y = 0; y < srcmap->height; y++) {
         for (x = 0; x < srcmap->width; x++) {
             chsrc = TextScreen_GetCell(srcmap, x, y);
@@ -644,77 +1281,355 @@ int TextScreen_CompareBitmap(const TextScreenBitmap *dstmap, const TextScreenBit
 
 void TextScreen_ClearBitmap(const TextScreenBitmap *bitmap)
 {
+    int y;
+    
     if (!bitmap) return;
-    TextScreen_DrawFillRect(bitmap, 0, 0, bitmap->width, bitmap->height, gSetting.space);
+    if (TextScreen_UnshareData(bitmap, 0)) return;
+    memset(bitmap->data, gSetting.space, bitmap->width * bitmap->height);
+    if (bitmap->rowhash) {
+        // all rows have same hash
+        bitmap->rowhash[0] = 0;
+        TextScreen_RowHash(bitmap, 0);
+        for (y = 1; y < bitmap->height; y++)
+            bitmap->rowhash[y] = bitmap->rowhash[0];
+    }
 }
 
-int TextScreen_ShowBitmap(const TextScreenBitmap *bitmap, int dx, int dy)
+// make space of len bytes at end of output buffer. return pointer to end of buffer (NULL: no memory)
+static char *TextScreen_OutputReserve(int len)
 {
-    char *buf;
-    char ch;
-    int  index;
-    int  i, x, y;
+    char *p;
+    int  size;
     
-    if (!gSetting.width || !gSetting.height)
-        TextScreen_Init(NULL);
+    if (gOutLen + len > gOutSize) {
+        size = (gOutLen + len) * 2;
+        p = (char *)realloc(gOutBuf, size);
+        if (!p) return NULL;
+        gOutBuf  = p;
+        gOutSize = size;
+    }
+    return gOutBuf + gOutLen;
+}
+
+// get time of high resolution counter (usec)
+static long long TextScreen_GetMicroTime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
     
-    if (!bitmap) return 0;
-    buf = NULL;
-    switch (gSetting.renderingMethod) {  // Create buffer
-        case TEXTSCREEN_RENDERING_METHOD_WINCONSOLE:
-        case TEXTSCREEN_RENDERING_METHOD_FAST:
-            buf = (char *)malloc( (gSetting.topMargin * 2) + 
-                    (gSetting.width+gSetting.leftMargin+2) * gSetting.height + 4 );
-            if (!buf) return -1;
-            break;
-        case TEXTSCREEN_RENDERING_METHOD_NORMAL:
-            buf = (char *)malloc(gSetting.width+gSetting.leftMargin+2);
-            if (!buf) return -1;
-            break;
-        case TEXTSCREEN_RENDERING_METHOD_SLOW:
-        default:
-            break;
+    if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&count))
+        return (long long)GetTickCount() * 1000;
+    return (long long)(count.QuadPart / freq.QuadPart) * 1000000
+         + (long long)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#endif
+}
+
+// write output buffer to console and empty it
+static int TextScreen_OutputWrite(void)
+{
+    int ret;
+    long long start;
+    
+    ret = 0;
+    if (gOutLen) {
+        start = TextScreen_GetMicroTime();
+#ifdef _WIN32
+        HANDLE stdh;
+        DWORD  wlen;
+        
+        fflush(stdout);
+        stdh = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (!stdh) {
+            ret = -1;
+        } else if (!WriteConsole(stdh, gOutBuf, gOutLen, &wlen, NULL)) {
+            // not console (redirected)
+            if (!WriteFile(stdh, gOutBuf, gOutLen, &wlen, NULL)) ret = -1;
+        }
+#else
+        char    *p;
+        int     len;
+        ssize_t wlen;
+        
+        fflush(stdout);  // keep order with printf()
+        p   = gOutBuf;
+        len = gOutLen;
+        while (len > 0) {
+            wlen = write(STDOUT_FILENO, p, len);
+            if (wlen < 0) {
+                if (errno == EINTR) continue;
+                ret = -1;
+                break;
+            }
+            p   += wlen;
+            len -= wlen;
+        }
+#endif
+        // console throughput (console blocks the write when it can not keep up)
+        gOutStatBytes += gOutLen;
+        gOutStatUsec  += (int)(TextScreen_GetMicroTime() - start);
     }
+    gOutLen = 0;
+    return ret;
+}
+
+// move cursor to (x, y) in order of output
+static int TextScreen_OutputCursor(int x, int y)
+{
+#ifdef _WIN32
+    HANDLE stdh;
+    COORD  coord;
     
+    TextScreen_OutputWrite();
+    stdh = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (!stdh) return -1;
+    coord.X = x;
+    coord.Y = y;
+    SetConsoleCursorPosition(stdh, coord);
+#else
+    char *p;
+    
+    p = TextScreen_OutputReserve(24);
+    if (!p) return -1;
+    gOutLen += snprintf(p, 24, "\x1b[%d;%dH", y+1, x+1);  // "\x1b[yy;xxH"
+#endif
+    return 0;
+}
+
+int TextScreen_BeginOutput(void)
+{
+    gOutBatch = 1;
+    return 0;
+}
+
+int TextScreen_FlushOutput(void)
+{
+    gOutBatch = 0;
+    return TextScreen_OutputWrite();
+}
+
+void TextScreen_GetOutputStats(int *bytes, int *usec)
+{
+    if (bytes) *bytes = gOutStatBytes;
+    if (usec)  *usec  = gOutStatUsec;
+    gOutStatBytes = 0;
+    gOutStatUsec  = 0;
+}
+
+int TextScreen_OutputText(const char *str)
+{
+    char *p;
+    int  len;
+    
+    if (!str) return 0;
+    len = strlen(str);
+    p = TextScreen_OutputReserve(len);
+    if (!p) return -1;
+    memcpy(p, str, len);
+    gOutLen += len;
+    if (!gOutBatch) return TextScreen_OutputWrite();
+    return 0;
+}
+
+// METHOD_DIFF: find next run of changed cells in row from *x. return 0: no more run
+static int TextScreen_DiffRun(const char *cur, const char *prev, int width, int *x, int *start, int *end)
+{
+    int xc, last;
+    
+    xc = *x;
+    while ((xc < width) && (cur[xc] == prev[xc])) xc++;
+    if (xc >= width) {
+        *x = width;
+        return 0;
+    }
+    *start = xc;
+    last = xc + 1;
+    for (xc = last; (xc < width) && (xc - last < SCREEN_DIFF_GAP); xc++) {
+        if (cur[xc] != prev[xc]) last = xc + 1;
+    }
+    *end = last;
+    *x = last;
+    return 1;
+}
+
+// METHOD_DIFF: output changed characters only. full repaint if it is cheaper (or no previous frame)
+static int TextScreen_ShowBitmapDiff(const TextScreenBitmap *bitmap, int dx, int dy)
+{
+    char *cur, *prev, *p;
+    int  width, height, size, fullsize, diffsize;
+    int  x, y, start, end, index;
+    int  usehash;
+    unsigned long long hash;
+    
+    width  = gSetting.width;
+    height = gSetting.height;
+    size   = width * height;
+    fullsize = gSetting.topMargin + (gSetting.leftMargin + width + 1) * height;
+    
+    if (size > gDiffSize) {
+        p = (char *)realloc(gDiffPrev, size);
+        if (!p) return -1;
+        gDiffPrev = p;
+        p = (char *)realloc(gDiffCur, size);
+        if (!p) return -1;
+        gDiffCur = p;
+        gDiffSize = size;
+        gDiffValid = 0;
+    }
+    if (height > gDiffRowHashSize) {
+        p = (char *)realloc(gDiffRowHash, height * sizeof(unsigned long long));
+        if (!p) return -1;
+        gDiffRowHash = (unsigned long long *)p;
+        p = (char *)realloc(gDiffRowSame, height);
+        if (!p) return -1;
+        gDiffRowSame = p;
+        gDiffRowHashSize = height;
+        gDiffValid = 0;
+    }
+    if ((width != gDiffWidth) || (height != gDiffHeight)) {
+        gDiffWidth  = width;
+        gDiffHeight = height;
+        gDiffValid  = 0;
+    }
+    // row hash of previous frame is usable if same position of same size bitmap
+    usehash = gDiffValid && bitmap->rowhash && (bitmap->width == gDiffBitmapWidth) && (dx == gDiffDx) && (dy == gDiffDy);
+    
+    // make current frame (copy row from previous frame if row hash is same)
+    for (y = 0; y < height; y++) {
+        hash = ((y + dy >= 0) && (y + dy < bitmap->height)) ? TextScreen_RowHash(bitmap, y + dy) : 0;
+        gDiffRowSame[y] = usehash && hash && (hash == gDiffRowHash[y]);
+        gDiffRowHash[y] = hash;
+        cur = gDiffCur + y * width;
+        if (gDiffRowSame[y]) {
+            memcpy(cur, gDiffPrev + y * width, width);
+            continue;
+        }
+        TextScreen_TranslateRow(cur, bitmap, dx, y + dy, width);
+    }
+    gDiffBitmapWidth = bitmap->width;
+    gDiffDx = dx;
+    gDiffDy = dy;
+    
+    // estimate output size of diff
+    diffsize = fullsize;
+    if (gDiffValid) {
+        diffsize = 0;
+        for (y = 0; (y < height) && (diffsize < fullsize); y++) {
+            if (gDiffRowSame[y]) continue;
+            cur  = gDiffCur  + y * width;
+            prev = gDiffPrev + y * width;
+            x = 0;
+            while (TextScreen_DiffRun(cur, prev, width, &x, &start, &end))
+                diffsize += SCREEN_DIFF_MOVE_COST + (end - start);
+        }
+    }
+    
+    if (diffsize < fullsize) {
 #ifdef _WIN32
-    do {  // set cursor position to 0,0 (top-left corner)
         HANDLE stdh;
         COORD  coord;
+        DWORD  wlen;
+        long long wstart;
+        
         stdh = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (stdh) {
-            coord.X = 0;
-            coord.Y = 0;
-            SetConsoleCursorPosition(stdh ,coord);
-        } else {
-            free(buf);
-            return -1;
+        if (!stdh) return -1;
+        // runs are written to console now (not collected in output buffer). flush earlier output first
+        TextScreen_OutputWrite();
+        wstart = TextScreen_GetMicroTime();
+        for (y = 0; y < height; y++) {
+            if (gDiffRowSame[y]) continue;
+            cur  = gDiffCur  + y * width;
+            prev = gDiffPrev + y * width;
+            x = 0;
+            while (TextScreen_DiffRun(cur, prev, width, &x, &start, &end)) {
+                coord.X = gSetting.leftMargin + start;
+                coord.Y = gSetting.topMargin + y;
+                WriteConsoleOutputCharacter(stdh, cur + start, end - start, coord, &wlen);
+                gOutStatBytes += end - start;
+            }
         }
-    } while(0);
+        // console throughput (same as TextScreen_OutputWrite)
+        gOutStatUsec += (int)(TextScreen_GetMicroTime() - wstart);
 #else
-    // printf("\x1b[?25l");    // hide cursor
-    printf("\x1b[1;1H");   // set cursor position to 1,1 (top-left corner)
+        for (y = 0; y < height; y++) {
+            if (gDiffRowSame[y]) continue;
+            cur  = gDiffCur  + y * width;
+            prev = gDiffPrev + y * width;
+            x = 0;
+            while (TextScreen_DiffRun(cur, prev, width, &x, &start, &end)) {
+                // move cursor "\x1b[yy;xxH" and characters
+                p = TextScreen_OutputReserve(24 + (end - start));
+                if (!p) return -1;
+                index = snprintf(p, 24, "\x1b[%d;%dH", gSetting.topMargin + y + 1, gSetting.leftMargin + start + 1);
+                memcpy(p + index, cur + start, end - start);
+                gOutLen += index + (end - start);
+            }
+        }
 #endif
+    } else {  // full repaint (cursor is at top-left corner)
+        p = TextScreen_OutputReserve(fullsize);
+        if (!p) return -1;
+        memset(p, 0x0a, gSetting.topMargin);
+        index = gSetting.topMargin;
+        for (y = 0; y < height; y++) {
+            memset(p + index, ' ', gSetting.leftMargin);
+            index += gSetting.leftMargin;
+            memcpy(p + index, gDiffCur + y * width, width);
+            index += width;
+            p[index++] = 0x0a;
+        }
+        gOutLen += index;
+    }
+    
+    // current frame will be previous frame
+    p = gDiffPrev;
+    gDiffPrev = gDiffCur;
+    gDiffCur = p;
+    gDiffValid = 1;
+    
+    return 0;
+}
 
+int TextScreen_ShowBitmap(const TextScreenBitmap *bitmap, int dx, int dy)
+{
+    char *buf;
+    char ch;
+    int  index;
+    int  i, x, y;
+    
+    if (!gSetting.width || !gSetting.height)
+        TextScreen_Init(NULL);
+    
+    if (!bitmap) return 0;
+    
+    // set cursor position to 0,0 (top-left corner)
+    if (TextScreen_OutputCursor(0, 0)) return -1;
+    
     if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_NORMAL) {
+        buf = (char *)malloc(gSetting.width+gSetting.leftMargin+2);
+        if (!buf) return -1;
+        TextScreen_OutputWrite();
         
         for (i = 0; i < gSetting.topMargin; i++)
             printf("\n");
         
         for (y = 0; y < gSetting.height; y++) {
-            index = 0;
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                buf[index++] = ' ';
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                buf[index++] = gSetting.translate[(unsigned char)ch];
-            }
+            memset(buf, ' ', gSetting.leftMargin);
+            index = gSetting.leftMargin;
+            TextScreen_TranslateRow(buf + index, bitmap, dx, y + dy, gSetting.width);
+            index += gSetting.width;
             buf[index++] = 0;
             printf("%s\n", buf);
         }
+        free(buf);
     }
     
     if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_SLOW) {
+        TextScreen_OutputWrite();
         
         for (i = 0; i < gSetting.topMargin; i++)
             printf("\n");
@@ -732,61 +1647,26 @@ int TextScreen_ShowBitmap(const TextScreenBitmap *bitmap, int dx, int dy)
         }
     }
     
-    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_FAST) {
-        index = 0;
-        for (i = 0; i < gSetting.topMargin; i++) {
-#ifdef _WIN32
-            // buf[index++] = 0x0d;
-            buf[index++] = 0x0a;
-#else
-            buf[index++] = 0x0a;
-#endif
-        }
+    // FAST and WINCONSOLE: build whole frame in output buffer (WINCONSOLE is same as FAST on non Windows)
+    if ((gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_FAST) ||
+        (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_WINCONSOLE)) {
+        buf = TextScreen_OutputReserve(gSetting.topMargin + (gSetting.width+gSetting.leftMargin+1) * gSetting.height);
+        if (!buf) return -1;
+        memset(buf, 0x0a, gSetting.topMargin);
+        index = gSetting.topMargin;
         for (y = 0; y < gSetting.height; y++) {
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                buf[index++] = ' ';
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                buf[index++] = gSetting.translate[(unsigned char)ch];
-            }
-#ifdef _WIN32
+            memset(buf + index, ' ', gSetting.leftMargin);
+            index += gSetting.leftMargin;
+            TextScreen_TranslateRow(buf + index, bitmap, dx, y + dy, gSetting.width);
+            index += gSetting.width;
             // buf[index++] = 0x0d;
             buf[index++] = 0x0a;
-#else
-            buf[index++] = 0x0a;
-#endif
         }
-        buf[index++] = 0;
-        printf("%s", buf);
+        gOutLen += index;
     }
     
-    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_WINCONSOLE) { // Windows only
-#ifdef _WIN32
-        HANDLE stdh;
-        DWORD  wlen;
-        
-        index = 0;
-        for (i = 0; i < gSetting.topMargin; i++) {
-            // buf[index++] = 0x0d;
-            buf[index++] = 0x0a;
-        }
-        for (y = 0; y < gSetting.height; y++) {
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                buf[index++] = ' ';
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                buf[index++] = gSetting.translate[(unsigned char)ch];
-            }
-            // buf[index++] = 0x0d;
-            buf[index++] = 0x0a;
-        }
-        stdh = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (stdh) {
-            WriteConsole(stdh, buf, index, &wlen, NULL);
-        }
-#endif
+    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_DIFF) {
+        if (TextScreen_ShowBitmapDiff(bitmap, dx, dy)) return -1;
     }
     
 #ifdef _WIN32
@@ -794,7 +1674,7 @@ int TextScreen_ShowBitmap(const TextScreenBitmap *bitmap, int dx, int dy)
     // printf("\x1b[?25h");  // show cursor
 #endif
     
-    if (buf) free(buf);
+    if (!gOutBatch) return TextScreen_OutputWrite();
     return 0;
 }
 
@@ -36,6 +36,7 @@ enum TextScreenRenderingMethod {
     TEXTSCREEN_RENDERING_METHOD_NORMAL,      // normal speed. good quality
     TEXTSCREEN_RENDERING_METHOD_SLOW,        // output character 1 by 1 (use fputc)
     TEXTSCREEN_RENDERING_METHOD_WINCONSOLE,  // use Windows console api (very fast, use WriteConsole())
+    TEXTSCREEN_RENDERING_METHOD_DIFF,        // output changed characters only (compare with previous frame)
     TEXTSCREEN_RENDERING_METHOD_NB           // number of method
 };
 
@@ -67,12 +68,20 @@ typedef struct TextScreenBitmap {
     void *exdata;
     // bitmap data handle (size = width x height). Create by TextScreen_CreateBitmap()
     char *data;
+    // content hash of each row (size = height, 0: not calculated). reset by draw functions
+    // Note: set rowhash[y] = 0 when write to 'data' directly. NULL: no row tracking
+    unsigned long long *rowhash;
+    // reference count of 'data' and 'rowhash' shared by TextScreen_ShareBitmap() (NULL: not shared)
+    // Note: call TextScreen_UnshareBitmap() before write to 'data' directly
+    int *refcount;
 } TextScreenBitmap;
 
 // initialize TextScreen library (NULL: use default setting)
 void TextScreen_Init(TextScreenSetting *usersetting);
 // clear console
 int TextScreen_ClearScreen(void);
+// forget previous frame of METHOD_DIFF (call after console is written by other than TextScreen)
+void TextScreen_InvalidateScreen(void);
 // get console size,  return  0: successful 1: error(could not get, width and height is set to default)
 int TextScreen_GetConsoleSize(int *width, int *height);
 // set cursor position (x, y),  (left, top) = (0, 0)
@@ -89,6 +98,9 @@ void TextScreen_SetSpaceChar(char ch);
 void TextScreen_GetSetting(TextScreenSetting *setting);
 // get copy of default settings
 void TextScreen_GetSettingDefault(TextScreenSetting *setting);
+// set memory report callback. called with +size when bitmap data is allocated, -size when freed
+// (called from thread which create/free bitmap. NULL: no report)
+void TextScreen_SetMemoryCallback(void (*callback)(int delta));
 
 // ******** bitmap draw tools ********
 // bitmap handle=bitmap; center position=(x,y);  radius=r;  draw character=ch
@@ -117,6 +129,20 @@ void TextScreen_FreeBitmap(TextScreenBitmap *bitmap);
 void TextScreen_CopyBitmap(const TextScreenBitmap *dstmap, const TextScreenBitmap *srcmap, int dx, int dy);
 // duplicate bitmap handle (create new bitmap and copy)   Note: member 'exdata' will not duplicate cause unknown its size
 TextScreenBitmap *TextScreen_DupBitmap(const TextScreenBitmap *bitmap);
+// share bitmap data (new handle refers same data. data is copied when either handle is drawn: copy on write)
+TextScreenBitmap *TextScreen_ShareBitmap(const TextScreenBitmap *bitmap);
+// make bitmap data exclusive (copy if shared),  return 0:successful  -1:failed
+int TextScreen_UnshareBitmap(const TextScreenBitmap *bitmap);
+// get cleared bitmap handle (width x height) from bitmap pool (create if pool has no bitmap of the size)
+TextScreenBitmap *TextScreen_AcquireBitmap(int width, int height);
+// return bitmap handle to bitmap pool for reuse (free oldest one when pool is full)
+void TextScreen_ReleaseBitmap(TextScreenBitmap *bitmap);
+// free all bitmaps in bitmap pool (call when screen size is changed)
+void TextScreen_FlushBitmapPool(void);
+// put rows of 8-bit samples (src: width x height, linesize bytes per row) to bitmap(0, 0) through 256-entry table
+// (character of cell = table[sample]. clipped to bitmap size)
+void TextScreen_MapBitmap(const TextScreenBitmap *bitmap, const unsigned char *src, int linesize,
+                          int width, int height, const char *table);
 // copy srcmap to dstmap(dx, dy) except null character
 void TextScreen_OverlayBitmap(const TextScreenBitmap *dstmap, const TextScreenBitmap *srcmap, int dx, int dy);
 // crop bitmap; position(x, y)  size=(w x h),  return 0:successful  -1:failed
@@ -124,12 +150,24 @@ int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int
 // resize bitmap; size=(w x h),  return 0:successful  -1:failed
 int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height);
 // compare srcmap and dstmap(dx, dy),  return 0:same   1,-1:different
+// (rows of same content hash are treated as same when both bitmaps are same size and dx = dy = 0)
 int TextScreen_CompareBitmap(const TextScreenBitmap *dstmap, const TextScreenBitmap *srcmap, int dx, int dy);
 // clear bitmap (fill space character)
 void TextScreen_ClearBitmap(const TextScreenBitmap *bitmap);
 // show bitmap to console. position of console(0,0) = bitmap(dx,dy),  return 0:successful  -1:error
 int TextScreen_ShowBitmap(const TextScreenBitmap *bitmap, int dx, int dy);
 
+// ******** output buffering ********
+// collect output of ShowBitmap, SetCursorPos and OutputText until FlushOutput (one write per frame)
+// (Windows: changed cells of METHOD_DIFF are written by console api at ShowBitmap. they are counted in OutputStats)
+int TextScreen_BeginOutput(void);
+// write collected output to console,  return 0:successful  -1:error
+int TextScreen_FlushOutput(void);
+// output text string at cursor position (collected if BeginOutput is called)
+int TextScreen_OutputText(const char *str);
+// get bytes written to console and time spent for writing them (usec) since last call (for frame pacing)
+void TextScreen_GetOutputStats(int *bytes, int *usec);
+
 #endif
 
 /* simple usage of this library ----------------------------------------
@@ -0,0 +1,349 @@
+/*
+    textscreen_bench.c , part of textmovie (rendering benchmark of textscreen.c)
+    Copyright (C) 2015-2016  by Coffey
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+    build (Linux, no FFmpeg and SDL):  make tsbench
+    usage:  tsbench [null|pty] [frames] [recorded.txt]
+        null : frames are written to /dev/null (cost of renderer only)
+        pty  : frames are written to pseudo terminal (drained by thread. cost of tty layer is included)
+        recorded.txt: text frames (e.g. print screen of textmovie) separated by empty line.
+                      frames are tiled to each console size
+    every rendering method renders each frame sequence at console sizes 80x25 to 400x120,
+    and reports ns/cell, bytes/frame (written to output) and frames/sec
+*/
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "textscreen.h"
+
+#define BENCH_FRAMES      120
+#define BENCH_MAXRECORDED 1024
+
+typedef struct BenchSize {
+    int width;
+    int height;
+} BenchSize;
+
+typedef struct BenchSequence {
+    const char       *name;
+    TextScreenBitmap **frames;
+    int              num;
+} BenchSequence;
+
+static const BenchSize gSizes[] = { { 80, 25 }, { 160, 50 }, { 240, 72 }, { 320, 96 }, { 400, 120 } };
+static const char *gMethodName[TEXTSCREEN_RENDERING_METHOD_NB] = { "fast", "normal", "slow", "winconsole", "diff" };
+
+static FILE *gReport;         // result output (stdout is used by textscreen)
+static int  gPtyMaster = -1;
+static pthread_t gDrainTid;
+
+// recorded frames (loaded from file. size of first frame)
+static TextScreenBitmap *gRecorded[BENCH_MAXRECORDED];
+static int gRecordedNum;
+
+static int64_t Bench_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t Bench_Rand(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// bytes written by this process (write() to output). -1: not available
+static int64_t Bench_WrittenBytes(void)
+{
+    FILE *fp;
+    char line[128];
+    long long wchar = -1;
+
+    fp = fopen("/proc/self/io", "r");
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "wchar: %lld", &wchar) == 1) break;
+    }
+    fclose(fp);
+    return wchar;
+}
+
+// ******** output sink ********
+static void *Drain_Entry(void *arg)
+{
+    char buf[65536];
+
+    (void)arg;
+    // read until slave side is closed (read returns EIO)
+    while (read(gPtyMaster, buf, sizeof(buf)) > 0);
+    return NULL;
+}
+
+// redirect stdout to /dev/null or pseudo terminal,  return 0:successful  -1:failed
+static int Sink_Open(int pty)
+{
+    int fd;
+
+    fflush(stdout);
+    gReport = fdopen(dup(STDOUT_FILENO), "w");
+    if (!gReport) return -1;
+
+    if (pty) {
+        gPtyMaster = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((gPtyMaster < 0) || grantpt(gPtyMaster) || unlockpt(gPtyMaster)) return -1;
+        fd = open(ptsname(gPtyMaster), O_WRONLY | O_NOCTTY);
+        if (fd < 0) return -1;
+        if (pthread_create(&gDrainTid, NULL, Drain_Entry, NULL)) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd < 0) return -1;
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    return 0;
+}
+
+static void Sink_Close(void)
+{
+    fflush(stdout);
+    dup2(fileno(gReport), STDOUT_FILENO);  // (close slave side of pty)
+    if (gPtyMaster >= 0) {
+        pthread_join(gDrainTid, NULL);
+        close(gPtyMaster);
+        gPtyMaster = -1;
+    }
+}
+
+// ******** frame sequences ********
+static TextScreenBitmap **Sequence_Alloc(int num, int width, int height)
+{
+    TextScreenBitmap **frames;
+    int i;
+
+    frames = (TextScreenBitmap **)calloc(num, sizeof(TextScreenBitmap *));
+    if (!frames) return NULL;
+    for (i = 0; i < num; i++) {
+        frames[i] = TextScreen_CreateBitmap(width, height);
+        if (!frames[i]) {
+            while (i--) TextScreen_FreeBitmap(frames[i]);
+            free(frames);
+            return NULL;
+        }
+    }
+    return frames;
+}
+
+static void Sequence_Free(BenchSequence *seq)
+{
+    int i;
+
+    if (!seq->frames) return;
+    for (i = 0; i < seq->num; i++)
+        TextScreen_FreeBitmap(seq->frames[i]);
+    free(seq->frames);
+    seq->frames = NULL;
+}
+
+// make frame sequence 'name' of width x height,  return 0:successful  -1:failed
+//   video : moving gradient and circle (every cell changes slowly, like decoded video)
+//   noise : random character every frame (worst case)
+//   static: same frame (best case of diff)
+//   sparse: static background and moving text box (like playlist and info view)
+//   recorded: frames of recorded.txt
+static int Sequence_Make(BenchSequence *seq, const char *name, int num, int width, int height)
+{
+    static const char ramp[] = " .-:+*H#";
+    uint32_t seed = 12345;
+    int i, x, y;
+    char ch;
+
+    seq->name   = name;
+    seq->num    = num;
+    seq->frames = Sequence_Alloc(num, width, height);
+    if (!seq->frames) return -1;
+
+    for (i = 0; i < num; i++) {
+        TextScreenBitmap *bitmap = seq->frames[i];
+
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                if (!strcmp(name, "video")) {
+                    ch = ramp[((x + y * 2 + i) / 4) & 7];
+                } else if (!strcmp(name, "noise")) {
+                    ch = ramp[Bench_Rand(&seed) & 7];
+                } else if (!strcmp(name, "static") || !strcmp(name, "sparse")) {
+                    ch = ramp[((x + y * 2) / 4) & 7];
+                } else {  // recorded
+                    TextScreenBitmap *src = gRecorded[i % gRecordedNum];
+                    ch = TextScreen_GetCell(src, x % src->width, y % src->height);
+                }
+                TextScreen_PutCell(bitmap, x, y, ch);
+            }
+        }
+        if (!strcmp(name, "video")) {
+            TextScreen_DrawCircle(bitmap, (i * 3) % width, height / 2, height / 4, '@');
+        } else if (!strcmp(name, "sparse")) {
+            TextScreen_DrawBorderRect(bitmap, (i * 2) % width, (i / 2) % height, 24, 5, '#', 1);
+            TextScreen_DrawText(bitmap, (i * 2) % width + 2, (i / 2) % height + 2, "sparse update");
+        }
+    }
+    return 0;
+}
+
+// load recorded frames (text separated by empty line),  return number of frames
+static int Recorded_Load(const char *filename)
+{
+    FILE *fp;
+    char line[TEXTSCREEN_MAXSIZE];
+    char *lines[512];
+    int  nline, width, len, y;
+
+    fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    nline = 0;
+    width = 0;
+    while (gRecordedNum < BENCH_MAXRECORDED) {
+        int eof = !fgets(line, sizeof(line), fp);
+
+        if (!eof) {
+            len = strcspn(line, "\r\n");
+            line[len] = 0;
+            if (len && (nline < 512)) {
+                lines[nline] = strdup(line);
+                if (!lines[nline]) break;
+                nline++;
+                if (len > width) width = len;
+                continue;
+            }
+        }
+        // end of frame
+        if (nline) {
+            TextScreenBitmap *bitmap = TextScreen_CreateBitmap(width, nline);
+
+            for (y = 0; y < nline; y++) {
+                if (bitmap) TextScreen_DrawText(bitmap, 0, y, lines[y]);
+                free(lines[y]);
+            }
+            if (bitmap) gRecorded[gRecordedNum++] = bitmap;
+            nline = 0;
+            width = 0;
+        }
+        if (eof) break;
+    }
+    for (y = 0; y < nline; y++) free(lines[y]);
+    fclose(fp);
+    return gRecordedNum;
+}
+
+// ******** benchmark ********
+static void Bench_Render(int method, const BenchSize *size, BenchSequence *seq)
+{
+    TextScreenSetting setting;
+    int64_t start, end, wstart, wend, cells;
+    int i, ret;
+
+    TextScreen_GetSettingDefault(&setting);
+    setting.width  = size->width;
+    setting.height = size->height;
+    setting.renderingMethod = method;
+    TextScreen_Init(&setting);
+
+    ret = 0;
+    wstart = Bench_WrittenBytes();
+    start  = Bench_Now();
+    for (i = 0; i < seq->num; i++) {
+        ret |= TextScreen_ShowBitmap(seq->frames[i], 0, 0);
+        fflush(stdout);  // (normal and slow use stdio)
+    }
+    end  = Bench_Now();
+    wend = Bench_WrittenBytes();
+
+    cells = (int64_t)seq->num * size->width * size->height;
+    fprintf(gReport, "  %-10s %3dx%-3d %-8s %7.2fns/cell", gMethodName[method], size->width, size->height,
+            seq->name, (double)(end - start) / cells);
+    if ((wstart >= 0) && (wend >= 0)) {
+        fprintf(gReport, " %8.0fbytes/frame", (double)(wend - wstart) / seq->num);
+    } else {
+        fprintf(gReport, "        n/a bytes/frame");
+    }
+    fprintf(gReport, " %9.1ffps%s\n", seq->num * 1e9 / (end - start), ret ? " (error)" : "");
+    fflush(gReport);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *synthetic[] = { "video", "noise", "static", "sparse" };
+    BenchSequence seq;
+    int frames = BENCH_FRAMES;
+    int pty = 0;
+    int s, q, m, nseq;
+
+    if (argc > 1) pty = !strcmp(argv[1], "pty");
+    if (argc > 2) frames = atoi(argv[2]);
+    if (frames < 1) frames = 1;
+    if ((argc > 3) && !Recorded_Load(argv[3])) {
+        printf("Can not load recorded frames: %s\n", argv[3]);
+        return 1;
+    }
+
+    if (Sink_Open(pty)) {
+        printf("Can not open output (%s)\n", pty ? "pty" : "/dev/null");
+        return 1;
+    }
+    fprintf(gReport, "textscreen rendering to %s, %d frames\n", pty ? "pty" : "/dev/null", frames);
+
+    nseq = sizeof(synthetic) / sizeof(synthetic[0]) + (gRecordedNum ? 1 : 0);
+    for (s = 0; s < (int)(sizeof(gSizes) / sizeof(gSizes[0])); s++) {
+        for (q = 0; q < nseq; q++) {
+            const char *name = (q < nseq - (gRecordedNum ? 1 : 0)) ? synthetic[q] : "recorded";
+
+            if (Sequence_Make(&seq, name, frames, gSizes[s].width, gSizes[s].height)) {
+                fprintf(gReport, "out of memory\n");
+                continue;
+            }
+            for (m = 0; m < TEXTSCREEN_RENDERING_METHOD_NB; m++)
+                Bench_Render(m, &gSizes[s], &seq);
+            Sequence_Free(&seq);
+        }
+    }
+
+    Sink_Close();
+    for (q = 0; q < gRecordedNum; q++) TextScreen_FreeBitmap(gRecorded[q]);
+    TextScreen_FlushBitmapPool();
+    return 0;
+}